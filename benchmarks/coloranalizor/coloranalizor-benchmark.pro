@@ -0,0 +1,20 @@
+# Compares the scanline color kernel of AsemanImageColorAnalizor with
+# the old QImage::pixel()/QColor implementation.
+# It is not part of the default build:
+#   qmake benchmarks/coloranalizor && make && ./coloranalizor-benchmark
+
+TEMPLATE = app
+TARGET = coloranalizor-benchmark
+QT += testlib gui
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+DEFINES += LIBASEMANTOOLS_LIBRARY
+INCLUDEPATH += $$PWD/../../lib
+
+SOURCES += \
+    $$PWD/tst_coloranalizorbenchmark.cpp \
+    $$PWD/../../lib/private/asemanimagecolorkernel.cpp
+
+HEADERS += \
+    $$PWD/../../lib/private/asemanimagecolorkernel.h
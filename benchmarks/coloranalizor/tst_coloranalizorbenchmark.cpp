@@ -0,0 +1,143 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asemanimagecoloranalizor.h"
+#include "private/asemanimagecolorkernel.h"
+
+#include <QtTest>
+#include <QImage>
+#include <QColor>
+
+class ColorAnalizorBenchmark : public QObject
+{
+    Q_OBJECT
+public:
+    ColorAnalizorBenchmark() {}
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void analize_data();
+    void analize();
+
+private:
+    static QImage makeImage(int width, int height);
+    static QColor legacy(const QImage &img, int method);
+
+    QHash<int, QImage> _images;
+};
+
+void ColorAnalizorBenchmark::initTestCase()
+{
+    // the scaled image the analizor reads, and a full size photo
+    _images[400] = makeImage(400, 300);
+    _images[4000] = makeImage(4000, 3000);
+}
+
+void ColorAnalizorBenchmark::analize_data()
+{
+    QTest::addColumn<int>("method");
+    QTest::addColumn<int>("width");
+    QTest::addColumn<bool>("scanline");
+
+    QList<int> methods;
+    methods << AsemanImageColorAnalizor::Normal << AsemanImageColorAnalizor::MoreSaturation;
+
+    for(int method: methods)
+        for(int width: QList<int>() << 400 << 4000)
+        {
+            const QString name = QString("%1/%2").arg(method==AsemanImageColorAnalizor::Normal? "Normal" : "MoreSaturation").arg(width);
+            QTest::newRow((name + "/pixel").toUtf8()) << method << width << false;
+            QTest::newRow((name + "/scanline").toUtf8()) << method << width << true;
+        }
+}
+
+void ColorAnalizorBenchmark::analize()
+{
+    QFETCH(int, method);
+    QFETCH(int, width);
+    QFETCH(bool, scanline);
+
+    const QImage &img = _images.value(width);
+    QCOMPARE(AsemanImageColorKernel::average(img, method), legacy(img, method));
+
+    QColor result;
+    QBENCHMARK {
+        result = scanline? AsemanImageColorKernel::average(img, method) : legacy(img, method);
+    }
+
+    QVERIFY(result.isValid());
+}
+
+QImage ColorAnalizorBenchmark::makeImage(int width, int height)
+{
+    QImage img(width, height, QImage::Format_ARGB32);
+    quint32 seed = 1;
+    for(int j=0; j<height; j++)
+    {
+        QRgb *line = reinterpret_cast<QRgb*>(img.scanLine(j));
+        for(int i=0; i<width; i++)
+        {
+            seed = seed*1103515245 + 12345;
+            const int noise = (seed >> 16) & 0x3f;
+            line[i] = qRgb((i*255/width + noise) & 0xff, (j*255/height + noise) & 0xff, ((i+j)/4 + noise) & 0xff);
+        }
+    }
+
+    return img;
+}
+
+/*
+ * The implementation before the scanline kernel, walking the image
+ * column by column and making a QColor of every pixel.
+ */
+QColor ColorAnalizorBenchmark::legacy(const QImage &img, int method)
+{
+    qreal sum_r = 0;
+    qreal sum_g = 0;
+    qreal sum_b = 0;
+    int count = 0;
+
+    for( int i=0 ; i<img.width(); i++ )
+    {
+        for( int j=0 ; j<img.height(); j++ )
+        {
+            QColor clr = img.pixel(i,j);
+            if( method == AsemanImageColorAnalizor::Normal )
+            {
+                qreal mid = (clr.red()+clr.green()+clr.blue())/3;
+                if( mid > 180 || mid < 70 )
+                    continue;
+            }
+            else
+            if( clr.saturation() < 150 || clr.lightness() < 50 )
+                continue;
+
+            sum_r += clr.red();
+            sum_g += clr.green();
+            sum_b += clr.blue();
+            count++;
+        }
+    }
+
+    return QColor( sum_r/count, sum_g/count, sum_b/count );
+}
+
+QTEST_APPLESS_MAIN(ColorAnalizorBenchmark)
+
+#include "tst_coloranalizorbenchmark.moc"
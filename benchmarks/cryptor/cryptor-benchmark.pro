@@ -0,0 +1,32 @@
+# Throughput benchmark of AsemanSimpleQtCryptor and AsemanEncrypter.
+# It is not part of the default build:
+#   qmake benchmarks/cryptor && make && ./cryptor-benchmark
+# Results are printed by QtTest and also written as JSON to
+# $ASEMAN_BENCH_JSON (default: cryptor-benchmark.json).
+# Set ASEMAN_BENCH_MAX_SIZE to limit the largest payload (bytes).
+
+TEMPLATE = app
+TARGET = cryptor-benchmark
+QT += testlib qml
+QT -= gui
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+DEFINES += LIBASEMANTOOLS_LIBRARY
+INCLUDEPATH += $$PWD/../../lib
+
+SOURCES += \
+    $$PWD/tst_cryptorbenchmark.cpp \
+    $$PWD/../../lib/asemansimpleqtcryptor.cpp \
+    $$PWD/../../lib/asemanencrypter.cpp \
+    $$PWD/../../lib/private/asemanencrypterasyncjob.cpp \
+    $$PWD/../../lib/private/asemanabstractjob.cpp \
+    $$PWD/../../lib/asemansysteminfo.cpp
+
+HEADERS += \
+    $$PWD/../../lib/asemansimpleqtcryptor.h \
+    $$PWD/../../lib/asemanencrypter.h \
+    $$PWD/../../lib/private/asemanencrypterasyncjob.h \
+    $$PWD/../../lib/private/asemanabstractjob.h \
+    $$PWD/../../lib/asemansysteminfo.h \
+    $$PWD/../../lib/private/serpent_sbox.h
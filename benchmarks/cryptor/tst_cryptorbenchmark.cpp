@@ -0,0 +1,378 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define DEFAULT_MAX_SIZE 268435456
+#define DEFAULT_JSON_PATH "cryptor-benchmark.json"
+
+#include "asemansimpleqtcryptor.h"
+#include "asemanencrypter.h"
+
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QFile>
+
+#if defined(Q_PROCESSOR_X86) && (defined(Q_CC_GNU) || defined(Q_CC_MSVC))
+#define WITH_RDTSC
+#ifdef Q_CC_MSVC
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+using namespace AsemanSimpleQtCryptor;
+
+Q_DECLARE_METATYPE(AsemanSimpleQtCryptor::Algorithm)
+Q_DECLARE_METATYPE(AsemanSimpleQtCryptor::Mode)
+Q_DECLARE_METATYPE(AsemanSimpleQtCryptor::Checksum)
+
+/*
+ * Sums the time of every QBENCHMARK iteration, so MB/s and cycles/byte
+ * can be written to the JSON report next to the QtTest output.
+ */
+class BenchmarkMeter
+{
+public:
+    BenchmarkMeter() : iterations(0), nsecs(0), cycles(0) {}
+
+    void start() {
+#ifdef WITH_RDTSC
+        startCycles = __rdtsc();
+#endif
+        timer.start();
+    }
+
+    void stop() {
+        nsecs += timer.nsecsElapsed();
+#ifdef WITH_RDTSC
+        cycles += __rdtsc() - startCycles;
+#endif
+        iterations++;
+    }
+
+    qint64 iterations;
+    qint64 nsecs;
+    quint64 cycles;
+
+private:
+    QElapsedTimer timer;
+    quint64 startCycles;
+};
+
+class CryptorBenchmark : public QObject
+{
+    Q_OBJECT
+public:
+    CryptorBenchmark();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void encryptor_data();
+    void encryptor();
+    void decryptor_data();
+    void decryptor();
+    void encrypter_data();
+    void encrypter();
+
+private:
+    void addRows(bool withChecksum);
+    void report(const QString &api, const QString &operation, Algorithm algorithm, Mode mode,
+                Checksum checksum, int size, const BenchmarkMeter &meter);
+    QByteArray payload(int size);
+
+    static QString algorithmName(Algorithm algorithm);
+    static QString modeName(Mode mode);
+    static QString checksumName(Checksum checksum);
+
+    QSharedPointer<Key> _key;
+    QList<int> _sizes;
+    QJsonArray _results;
+    QByteArray _payload;
+};
+
+CryptorBenchmark::CryptorBenchmark()
+{
+    qRegisterMetaType<Algorithm>();
+    qRegisterMetaType<Mode>();
+    qRegisterMetaType<Checksum>();
+}
+
+void CryptorBenchmark::initTestCase()
+{
+    InitializationVector::initiate();
+    _key = QSharedPointer<Key>(new Key(QString("aseman-benchmark")));
+
+    qint64 maxSize = qgetenv("ASEMAN_BENCH_MAX_SIZE").toLongLong();
+    if(maxSize <= 0 || maxSize > DEFAULT_MAX_SIZE)
+        maxSize = DEFAULT_MAX_SIZE;
+
+    for(qint64 size=16; size<=maxSize; size*=16)
+        _sizes << size;
+}
+
+void CryptorBenchmark::cleanupTestCase()
+{
+    QJsonObject root;
+    root["benchmark"] = QString("cryptor");
+    root["qtVersion"] = QString(qVersion());
+    root["results"] = _results;
+
+    QString path = QString::fromLocal8Bit(qgetenv("ASEMAN_BENCH_JSON"));
+    if(path.isEmpty())
+        path = DEFAULT_JSON_PATH;
+
+    QFile file(path);
+    if(!file.open(QFile::WriteOnly | QFile::Truncate))
+    {
+        qWarning() << "Could not write benchmark results to" << path;
+        return;
+    }
+
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Indented));
+}
+
+void CryptorBenchmark::addRows(bool withChecksum)
+{
+    QTest::addColumn<Algorithm>("algorithm");
+    QTest::addColumn<Mode>("mode");
+    QTest::addColumn<Checksum>("checksum");
+    QTest::addColumn<int>("size");
+
+    QList<Algorithm> algorithms;
+#ifdef WITHRC5
+    algorithms << RC5_32_32_20 << RC5_64_32_20;
+#endif
+    algorithms << SERPENT_32;
+
+    QList<Mode> modes;
+    modes << ModeCBC << ModeCFB << ModeCTR;
+
+    QList<Checksum> checksums;
+    checksums << NoChecksum;
+    if(withChecksum)
+        checksums << ChecksumSoft << ChecksumHard;
+
+    for(Algorithm algorithm: algorithms)
+        for(Mode mode: modes)
+        {
+            // counter mode needs 16 byte blocks
+            if(mode == ModeCTR && CTR::blockSize(algorithm) == 0)
+                continue;
+
+            for(Checksum checksum: checksums)
+                for(int size: _sizes)
+                {
+                    const QString name = QString("%1/%2/%3/%4").arg(algorithmName(algorithm), modeName(mode),
+                                                                    checksumName(checksum)).arg(size);
+                    QTest::newRow(name.toUtf8()) << algorithm << mode << checksum << size;
+                }
+        }
+}
+
+void CryptorBenchmark::encryptor_data()
+{
+    addRows(true);
+}
+
+void CryptorBenchmark::encryptor()
+{
+    QFETCH(Algorithm, algorithm);
+    QFETCH(Mode, mode);
+    QFETCH(Checksum, checksum);
+    QFETCH(int, size);
+
+    const QByteArray plain = payload(size);
+    QByteArray cipher;
+
+    Encryptor probe(_key, algorithm, mode, checksum);
+    const Error err = probe.encrypt(plain.left(16), cipher, true);
+    if(err == ErrorChecksumNotImplemented)
+        QSKIP("Checksum is not implemented");
+    QCOMPARE(err, NoError);
+
+    BenchmarkMeter meter;
+    QBENCHMARK {
+        Encryptor enc(_key, algorithm, mode, checksum);
+        meter.start();
+        enc.encrypt(plain, cipher, true);
+        meter.stop();
+    }
+
+    report("Encryptor", "encrypt", algorithm, mode, checksum, size, meter);
+}
+
+void CryptorBenchmark::decryptor_data()
+{
+    addRows(false);
+}
+
+void CryptorBenchmark::decryptor()
+{
+    QFETCH(Algorithm, algorithm);
+    QFETCH(Mode, mode);
+    QFETCH(Checksum, checksum);
+    QFETCH(int, size);
+
+    const QByteArray plain = payload(size);
+    QByteArray cipher;
+    Encryptor enc(_key, algorithm, mode, checksum);
+    QCOMPARE(enc.encrypt(plain, cipher, true), NoError);
+
+    QByteArray result;
+    BenchmarkMeter meter;
+    QBENCHMARK {
+        Decryptor dec(_key, algorithm, mode);
+        meter.start();
+        dec.decrypt(cipher, result, true);
+        meter.stop();
+    }
+
+    QVERIFY(result == plain);
+    report("Decryptor", "decrypt", algorithm, mode, checksum, size, meter);
+}
+
+void CryptorBenchmark::encrypter_data()
+{
+    QTest::addColumn<bool>("encrypt");
+    QTest::addColumn<int>("size");
+
+    for(int size: _sizes)
+    {
+        QTest::newRow(QString("encrypt/%1").arg(size).toUtf8()) << true << size;
+        QTest::newRow(QString("decrypt/%1").arg(size).toUtf8()) << false << size;
+    }
+}
+
+void CryptorBenchmark::encrypter()
+{
+    QFETCH(bool, encrypt);
+    QFETCH(int, size);
+
+    AsemanEncrypter encrypter;
+    encrypter.setKey("aseman-benchmark");
+
+    const QByteArray plain = payload(size);
+    const QByteArray cipher = encrypter.encrypt(plain);
+
+    QByteArray result;
+    BenchmarkMeter meter;
+    QBENCHMARK {
+        meter.start();
+        result = encrypt? encrypter.encrypt(plain) : encrypter.decrypt(cipher);
+        meter.stop();
+    }
+
+    if(!encrypt)
+        QVERIFY(result == plain);
+
+    report("AsemanEncrypter", encrypt? "encrypt" : "decrypt", SERPENT_32, ModeCFB, NoChecksum, size, meter);
+}
+
+void CryptorBenchmark::report(const QString &api, const QString &operation, Algorithm algorithm, Mode mode,
+                              Checksum checksum, int size, const BenchmarkMeter &meter)
+{
+    if(meter.iterations == 0 || meter.nsecs == 0)
+        return;
+
+    const double bytes = double(size) * meter.iterations;
+    QJsonObject result;
+    result["api"] = api;
+    result["operation"] = operation;
+    result["algorithm"] = algorithmName(algorithm);
+    result["mode"] = modeName(mode);
+    result["checksum"] = checksumName(checksum);
+    result["size"] = size;
+    result["iterations"] = meter.iterations;
+    result["mbPerSecond"] = bytes / (1024.0*1024.0) / (meter.nsecs / 1000000000.0);
+#ifdef WITH_RDTSC
+    result["cyclesPerByte"] = meter.cycles / bytes;
+#else
+    result["cyclesPerByte"] = QJsonValue();
+#endif
+
+    _results.append(result);
+}
+
+QByteArray CryptorBenchmark::payload(int size)
+{
+    if(_payload.size() < size)
+    {
+        _payload.resize(size);
+        char *data = _payload.data();
+        for(int i=0; i<size; i++)
+            data[i] = char(i*131 + (i>>8));
+    }
+
+    return _payload.left(size);
+}
+
+QString CryptorBenchmark::algorithmName(Algorithm algorithm)
+{
+    switch(algorithm)
+    {
+#ifdef WITHRC5
+    case RC5_32_32_20:
+        return "RC5_32_32_20";
+    case RC5_64_32_20:
+        return "RC5_64_32_20";
+#endif
+    case SERPENT_32:
+        return "SERPENT_32";
+    default:
+        return "Unknown";
+    }
+}
+
+QString CryptorBenchmark::modeName(Mode mode)
+{
+    switch(mode)
+    {
+    case ModeCBC:
+        return "CBC";
+    case ModeCFB:
+        return "CFB";
+    case ModeCTR:
+        return "CTR";
+    default:
+        return "Unknown";
+    }
+}
+
+QString CryptorBenchmark::checksumName(Checksum checksum)
+{
+    switch(checksum)
+    {
+    case NoChecksum:
+        return "NoChecksum";
+    case ChecksumSoft:
+        return "ChecksumSoft";
+    case ChecksumHard:
+        return "ChecksumHard";
+    default:
+        return "Unknown";
+    }
+}
+
+QTEST_APPLESS_MAIN(CryptorBenchmark)
+
+#include "tst_cryptorbenchmark.moc"
@@ -0,0 +1,22 @@
+# Compares the natural sort keys of AsemanFileSystemModel with the old
+# comparator that tokenized both names on every comparison.
+# It is not part of the default build:
+#   qmake benchmarks/filesystemsort && make && ./filesystemsort-benchmark
+# Set ASEMAN_BENCH_MAX_COUNT to limit the biggest synthetic folder.
+
+TEMPLATE = app
+TARGET = filesystemsort-benchmark
+QT += testlib
+QT -= gui
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+DEFINES += LIBASEMANTOOLS_LIBRARY
+INCLUDEPATH += $$PWD/../../lib
+
+SOURCES += \
+    $$PWD/tst_filesystemsortbenchmark.cpp \
+    $$PWD/../../lib/private/asemanfilesystemsortkeys.cpp
+
+HEADERS += \
+    $$PWD/../../lib/private/asemanfilesystemsortkeys.h
@@ -0,0 +1,231 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define DEFAULT_MAX_COUNT 1000000
+#define LEGACY_MAX_COUNT 100000
+
+#include "private/asemanfilesystemsortkeys.h"
+
+#include <QtTest>
+#include <QStringList>
+
+class FileSystemSortBenchmark : public QObject
+{
+    Q_OBJECT
+public:
+    FileSystemSortBenchmark() {}
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void sort_data();
+    void sort();
+
+private:
+    class LegacyEntry
+    {
+    public:
+        QString name;
+        bool isDir;
+    };
+
+    class SortUnitType
+    {
+    public:
+        SortUnitType(): num(0){}
+        QChar ch;
+        quint64 num;
+    };
+
+    static QList<SortUnitType> legacyAnalize(const QString &fileName);
+    static bool legacyLessThan(const LegacyEntry &f1, const LegacyEntry &f2);
+    static QStringList makeNames(int count);
+
+    QList<int> _counts;
+    QHash<int, QStringList> _names;
+};
+
+void FileSystemSortBenchmark::initTestCase()
+{
+    int maxCount = qgetenv("ASEMAN_BENCH_MAX_COUNT").toInt();
+    if(maxCount <= 0 || maxCount > DEFAULT_MAX_COUNT)
+        maxCount = DEFAULT_MAX_COUNT;
+
+    for(int count=10000; count<=maxCount; count*=10)
+    {
+        _counts << count;
+        _names[count] = makeNames(count);
+    }
+}
+
+void FileSystemSortBenchmark::sort_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("keys");
+
+    for(int count: _counts)
+    {
+        // the old comparator allocates on every compare, a million
+        // names take minutes with it
+        if(count <= LEGACY_MAX_COUNT)
+            QTest::newRow(QString("%1/legacy").arg(count).toUtf8()) << count << false;
+        QTest::newRow(QString("%1/keys").arg(count).toUtf8()) << count << true;
+    }
+}
+
+void FileSystemSortBenchmark::sort()
+{
+    QFETCH(int, count);
+    QFETCH(bool, keys);
+
+    const QStringList &names = _names.value(count);
+    QList<LegacyEntry> entries;
+    for(int i=0; i<names.count(); i++)
+    {
+        LegacyEntry entry;
+        entry.name = names.at(i);
+        entry.isDir = (i%7 == 0);
+        entries << entry;
+    }
+
+    QStringList result;
+    QBENCHMARK_ONCE {
+        result.clear();
+        if(keys)
+        {
+            AsemanFileSystemSortKeys sortKeys;
+            sortKeys.reserve(entries.count());
+            for(const LegacyEntry &entry: entries)
+                sortKeys.append(entry.name, entry.isDir, true);
+            for(int idx: sortKeys.sortedIndexes())
+                result << entries.at(idx).name;
+        }
+        else
+        {
+            QList<LegacyEntry> sorted = entries;
+            qStableSort(sorted.begin(), sorted.end(), legacyLessThan);
+            for(const LegacyEntry &entry: sorted)
+                result << entry.name;
+        }
+    }
+
+    QCOMPARE(result.count(), count);
+    if(keys && count <= 10000)
+    {
+        QList<LegacyEntry> sorted = entries;
+        qStableSort(sorted.begin(), sorted.end(), legacyLessThan);
+        for(int i=0; i<sorted.count(); i++)
+            QCOMPARE(result.at(i), sorted.at(i).name);
+    }
+}
+
+/*
+ * The comparator AsemanFileSystemModel used before the sort keys,
+ * with the dirs first option set.
+ */
+QList<FileSystemSortBenchmark::SortUnitType> FileSystemSortBenchmark::legacyAnalize(const QString &fileName)
+{
+    QList<SortUnitType> res;
+    for(int i=0; i<fileName.length(); i++)
+    {
+        const QChar &ch = fileName[i];
+        if(ch.isNumber())
+        {
+            int num = QString(ch).toInt();
+            if(res.isEmpty() || !res.last().ch.isNull() )
+                res << SortUnitType();
+
+            SortUnitType & resUnit = res[res.length()-1];
+            resUnit.num = resUnit.num*10 + num;
+        }
+        else
+        {
+            SortUnitType unit;
+            unit.ch = ch;
+            res << unit;
+        }
+    }
+
+    return res;
+}
+
+bool FileSystemSortBenchmark::legacyLessThan(const LegacyEntry &f1, const LegacyEntry &f2)
+{
+    if(f1.isDir && !f2.isDir)
+        return true;
+    if(!f1.isDir && f2.isDir)
+        return false;
+
+    const QList<SortUnitType> &ul1 = legacyAnalize(f1.name);
+    const QList<SortUnitType> &ul2 = legacyAnalize(f2.name);
+
+    for(int i=0; i<ul1.length() && i<ul2.length(); i++)
+    {
+        const SortUnitType &u1 = ul1.at(i);
+        const SortUnitType &u2 = ul2.at(i);
+
+        if(u1.ch.isNull() && !u2.ch.isNull())
+            return true;
+        if(!u1.ch.isNull() && u2.ch.isNull())
+            return false;
+        if(!u1.ch.isNull() && !u2.ch.isNull())
+        {
+            if(u1.ch < u2.ch)
+                return true;
+            if(u1.ch > u2.ch)
+                return false;
+        }
+        if(u1.ch.isNull() && u2.ch.isNull())
+        {
+            if(u1.num < u2.num)
+                return true;
+            if(u1.num > u2.num)
+                return false;
+        }
+    }
+
+    return ul1.length() < ul2.length();
+}
+
+/*
+ * Camera, document and numbered names in a shuffled order, the kind of
+ * folders natural sorting is about.
+ */
+QStringList FileSystemSortBenchmark::makeNames(int count)
+{
+    static const char *prefixes[] = { "IMG_", "DSC", "Screenshot from 2017-", "report v", "track ", "Photo (", "backup-" };
+    static const char *suffixes[] = { ".jpg", ".JPG", ".png", ".pdf", ".mp3", ").jpeg", ".tar.gz" };
+
+    QStringList res;
+    res.reserve(count);
+    quint32 seed = 1;
+    for(int i=0; i<count; i++)
+    {
+        seed = seed*1103515245 + 12345;
+        const int kind = (seed >> 16) % 7;
+        seed = seed*1103515245 + 12345;
+        const int number = (seed >> 8) % (count*4);
+        res << QString("%1%2%3").arg(prefixes[kind]).arg(number).arg(suffixes[kind]);
+    }
+
+    return res;
+}
+
+QTEST_APPLESS_MAIN(FileSystemSortBenchmark)
+
+#include "tst_filesystemsortbenchmark.moc"
@@ -0,0 +1,472 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define DEFAULT_CHUNK_SIZE 65536
+#define HEADER_RESERVE 64
+
+#include "asemanencrypteddevice.h"
+
+#include <QString>
+#include <QFile>
+#include <QFileDevice>
+
+using namespace AsemanSimpleQtCryptor;
+
+class AsemanEncryptedDevicePrivate
+{
+public:
+    QIODevice *device;
+    bool deviceOpened;
+
+    QSharedPointer<Key> key;
+    Algorithm algorithm;
+    Mode mode;
+    int chunkSize;
+    Error error;
+
+    Encryptor *encryptor;
+    Decryptor *decryptor;
+
+    CTR *ctr;
+    uchar *map;
+    qint64 dataOffset;
+    qint64 dataSize;
+    qint64 headerSize;
+
+    QByteArray pending;
+    QByteArray plain;
+    int plainPos;
+    bool started;
+    bool finished;
+    bool sourceFinished;
+};
+
+AsemanEncryptedDevice::AsemanEncryptedDevice(QIODevice *device, QSharedPointer<Key> key, Algorithm algorithm, Mode mode, QObject *parent) :
+    QIODevice(parent)
+{
+    p = new AsemanEncryptedDevicePrivate;
+    p->device = device;
+    p->deviceOpened = false;
+    p->key = key;
+    p->algorithm = algorithm;
+    p->mode = mode;
+    p->chunkSize = DEFAULT_CHUNK_SIZE;
+    p->error = NoError;
+    p->encryptor = 0;
+    p->decryptor = 0;
+    p->ctr = 0;
+    p->map = 0;
+    p->dataOffset = 0;
+    p->dataSize = 0;
+    p->headerSize = 0;
+    p->plainPos = 0;
+    p->started = false;
+    p->finished = false;
+    p->sourceFinished = false;
+}
+
+QIODevice *AsemanEncryptedDevice::device() const
+{
+    return p->device;
+}
+
+void AsemanEncryptedDevice::setChunkSize(int size)
+{
+    p->chunkSize = qMax(size, HEADER_RESERVE);
+}
+
+int AsemanEncryptedDevice::chunkSize() const
+{
+    return p->chunkSize;
+}
+
+Error AsemanEncryptedDevice::error() const
+{
+    return p->error;
+}
+
+bool AsemanEncryptedDevice::open(OpenMode mode)
+{
+    if(isOpen() || !p->device)
+        return false;
+
+    const bool reading = (mode & ReadOnly);
+    const bool writing = (mode & WriteOnly);
+    if(reading == writing)
+    {
+        setErrorString("AsemanEncryptedDevice can only be opened ReadOnly or WriteOnly");
+        return false;
+    }
+
+    const OpenMode deviceMode = reading? ReadOnly : WriteOnly;
+    if(!p->device->isOpen())
+    {
+        if(!p->device->open(deviceMode))
+        {
+            setErrorString(p->device->errorString());
+            return false;
+        }
+        p->deviceOpened = true;
+    }
+    else
+    if((p->device->openMode() & deviceMode) != deviceMode)
+    {
+        setErrorString("Underlying device is not opened in a compatible mode");
+        return false;
+    }
+
+    p->error = NoError;
+    p->pending.clear();
+    p->plain.clear();
+    p->plainPos = 0;
+    p->started = false;
+    p->finished = false;
+    p->sourceFinished = false;
+    // A sequential source can not seek, it is streamed like the other modes
+    if(reading && p->mode == ModeCTR && !p->device->isSequential())
+    {
+        if(!openRandomAccess())
+        {
+            QFile *file = qobject_cast<QFile*>(p->device);
+            if(file && p->map)
+                file->unmap(p->map);
+            delete p->ctr;
+            p->ctr = 0;
+            p->map = 0;
+            if(p->deviceOpened)
+                p->device->close();
+            p->deviceOpened = false;
+            return false;
+        }
+    }
+    else
+    if(reading)
+    {
+        p->decryptor = new Decryptor(p->key, p->algorithm, p->mode);
+        if(p->device->isSequential())
+        {
+            connect(p->device, &QIODevice::readyRead, this, &AsemanEncryptedDevice::readyRead);
+            connect(p->device, &QIODevice::readChannelFinished, this, [this](){
+                p->sourceFinished = true;
+                Q_EMIT readyRead();
+                Q_EMIT readChannelFinished();
+            });
+        }
+    }
+    else
+        p->encryptor = new Encryptor(p->key, p->algorithm, p->mode, NoChecksum);
+
+    return QIODevice::open(mode | Unbuffered);
+}
+
+/*
+ * Reads the IV and checks the header, so the rest of the file can be
+ * decrypted at any offset later.
+ */
+bool AsemanEncryptedDevice::openRandomAccess()
+{
+    const QByteArray header = Info::header(p->algorithm, p->mode);
+    const int blockSize = CTR::blockSize(p->algorithm);
+    if(header.isEmpty() || blockSize == 0)
+    {
+        setError(p->algorithm == DetectAlgorithm? ErrorNoAlgorithm : ErrorAlgorithmNotImplemented);
+        return false;
+    }
+
+    p->headerSize = header.size();
+    p->dataOffset = blockSize + p->headerSize;
+    p->dataSize = p->device->size() - p->dataOffset;
+    if(p->dataSize < 0 || !p->device->seek(0))
+    {
+        setError(ErrorNotEnoughData);
+        return false;
+    }
+
+    QFile *file = qobject_cast<QFile*>(p->device);
+    if(file)
+        p->map = file->map(0, p->device->size());
+
+    QByteArray prefix;
+    if(p->map)
+        prefix = QByteArray::fromRawData(reinterpret_cast<const char*>(p->map), p->dataOffset);
+    else
+        prefix = p->device->read(p->dataOffset);
+    if(prefix.size() != p->dataOffset)
+    {
+        setError(ErrorNotEnoughData);
+        return false;
+    }
+
+    p->ctr = new CTR(p->key, p->algorithm);
+    p->ctr->setIv(prefix.left(blockSize));
+
+    QByteArray plainHeader(p->headerSize, 0);
+    p->ctr->crypt(reinterpret_cast<const uchar*>(prefix.constData()) + blockSize,
+                  reinterpret_cast<uchar*>(plainHeader.data()), p->headerSize, 0);
+    if(plainHeader != header)
+    {
+        setError(ErrorInvalidKey);
+        return false;
+    }
+
+    return true;
+}
+
+void AsemanEncryptedDevice::close()
+{
+    if(!isOpen())
+        return;
+
+    if(p->encryptor && p->error == NoError)
+    {
+        QByteArray cipher;
+        const Error err = p->encryptor->encrypt(QByteArray(), cipher, true);
+        if(err != NoError)
+            setError(err);
+        else
+        if(p->device->write(cipher) != cipher.size())
+            setErrorString(p->device->errorString());
+    }
+
+    if(p->map)
+    {
+        QFile *file = qobject_cast<QFile*>(p->device);
+        if(file)
+            file->unmap(p->map);
+    }
+
+    disconnect(p->device, 0, this, 0);
+    delete p->encryptor;
+    delete p->decryptor;
+    delete p->ctr;
+    p->encryptor = 0;
+    p->decryptor = 0;
+    p->ctr = 0;
+    p->map = 0;
+    p->pending.clear();
+    p->plain.clear();
+    p->plainPos = 0;
+
+    if(p->deviceOpened)
+        p->device->close();
+    p->deviceOpened = false;
+
+    QIODevice::close();
+}
+
+bool AsemanEncryptedDevice::isSequential() const
+{
+    return !p->ctr;
+}
+
+bool AsemanEncryptedDevice::atEnd() const
+{
+    if(!isOpen())
+        return true;
+    if(p->ctr)
+        return pos() >= p->dataSize;
+    if(!p->decryptor)
+        return false;
+
+    return p->finished && p->plainPos == p->plain.size();
+}
+
+qint64 AsemanEncryptedDevice::bytesAvailable() const
+{
+    return (p->plain.size() - p->plainPos) + QIODevice::bytesAvailable();
+}
+
+qint64 AsemanEncryptedDevice::size() const
+{
+    if(p->ctr)
+        return p->dataSize;
+
+    return QIODevice::size();
+}
+
+bool AsemanEncryptedDevice::seek(qint64 pos)
+{
+    if(!p->ctr || pos < 0 || pos > p->dataSize)
+        return false;
+
+    return QIODevice::seek(pos);
+}
+
+qint64 AsemanEncryptedDevice::readData(char *data, qint64 maxlen)
+{
+    if(p->ctr && p->error == NoError)
+        return readRandomAccess(data, maxlen);
+    if(!p->decryptor || p->error != NoError)
+        return -1;
+
+    qint64 done = 0;
+    while(done < maxlen)
+    {
+        if(p->plainPos == p->plain.size() && !fetch())
+            break;
+
+        const int size = qMin<qint64>(maxlen - done, p->plain.size() - p->plainPos);
+        memcpy(data + done, p->plain.constData() + p->plainPos, size);
+        p->plainPos += size;
+        done += size;
+    }
+
+    if(p->error != NoError && done == 0)
+        return -1;
+
+    return done;
+}
+
+qint64 AsemanEncryptedDevice::writeData(const char *data, qint64 len)
+{
+    if(!p->encryptor || p->error != NoError)
+        return -1;
+
+    qint64 done = 0;
+    while(done < len)
+    {
+        const int size = qMin<qint64>(p->chunkSize, len - done);
+        QByteArray cipher;
+        const Error err = p->encryptor->encrypt(QByteArray::fromRawData(data + done, size), cipher, false);
+        if(err != NoError)
+        {
+            setError(err);
+            return -1;
+        }
+        if(p->device->write(cipher) != cipher.size())
+        {
+            setErrorString(p->device->errorString());
+            return done? done : -1;
+        }
+
+        done += size;
+    }
+
+    return done;
+}
+
+/*
+ * Decrypts maxlen bytes at pos() straight into data. With a mapped file
+ * only the touched pages are read from disk.
+ */
+qint64 AsemanEncryptedDevice::readRandomAccess(char *data, qint64 maxlen)
+{
+    const qint64 offset = pos();
+    const qint64 len = qMin(maxlen, p->dataSize - offset);
+    if(len <= 0)
+        return 0;
+
+    uchar *out = reinterpret_cast<uchar*>(data);
+    const uchar *in = out;
+    if(p->map)
+        in = p->map + p->dataOffset + offset;
+    else
+    if(!p->device->seek(p->dataOffset + offset) || p->device->read(data, len) != len)
+    {
+        setErrorString(p->device->errorString());
+        return -1;
+    }
+
+    qint64 done = 0;
+    while(done < len)
+    {
+        const int size = qMin<qint64>(p->chunkSize, len - done);
+        p->ctr->crypt(in + done, out + done, size, p->headerSize + offset + done);
+        done += size;
+    }
+
+    return len;
+}
+
+/*
+ * Decrypts the next chunk of the source device into p->plain.
+ * The first call collects at least HEADER_RESERVE bytes, because the
+ * decryptor needs the whole IV and header in its first input.
+ * A sequential source that has no bytes yet is not at its end, then
+ * it returns false and readyRead() tells when to read again.
+ */
+bool AsemanEncryptedDevice::fetch()
+{
+    p->plain.clear();
+    p->plainPos = 0;
+
+    while(p->plain.isEmpty() && !p->finished)
+    {
+        QByteArray chunk = p->device->read(p->chunkSize);
+        const bool end = sourceAtEnd(chunk.isEmpty());
+        if(chunk.isEmpty() && !end)
+            break;
+
+        if(!p->started)
+        {
+            p->pending.append(chunk);
+            if(p->pending.size() < HEADER_RESERVE && !end)
+                continue;
+
+            chunk = p->pending;
+            p->pending.clear();
+            p->started = true;
+        }
+
+        const Error err = p->decryptor->decrypt(chunk, p->plain, end);
+        if(err != NoError)
+        {
+            p->plain.clear();
+            setError(err);
+            p->finished = true;
+            return false;
+        }
+
+        p->finished = end;
+    }
+
+    return !p->plain.isEmpty();
+}
+
+/*
+ * A random access source ends with atEnd() or an empty read. A
+ * sequential one, like a socket or a process, may only be waiting for
+ * more bytes: it ends with readChannelFinished() or when it is closed.
+ * Files on pipes never emit that signal, but they block on read, so
+ * their atEnd() is right after an empty read.
+ */
+bool AsemanEncryptedDevice::sourceAtEnd(bool emptyRead) const
+{
+    if(!p->device->isSequential())
+        return p->device->atEnd() || emptyRead;
+    if(!p->device->isOpen())
+        return true;
+    if(p->device->bytesAvailable() > 0)
+        return false;
+    if(p->sourceFinished)
+        return true;
+
+    return emptyRead && qobject_cast<QFileDevice*>(p->device) && p->device->atEnd();
+}
+
+void AsemanEncryptedDevice::setError(Error error)
+{
+    p->error = error;
+    setErrorString(Info::errorText(error));
+}
+
+AsemanEncryptedDevice::~AsemanEncryptedDevice()
+{
+    close();
+    delete p;
+}
@@ -0,0 +1,87 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANENCRYPTEDDEVICE_H
+#define ASEMANENCRYPTEDDEVICE_H
+
+#include <QIODevice>
+
+#include "asemansimpleqtcryptor.h"
+#include "asemantools_global.h"
+
+/*
+ * Streams data through the AsemanSimpleQtCryptor mode layers.
+ *  - Open it WriteOnly to encrypt everything written into the wrapped
+ *    device. The output is only complete after close().
+ *  - Open it ReadOnly to decrypt the wrapped device while reading.
+ *    A sequential device, like a socket, is decrypted as its bytes
+ *    arrive. readyRead() and readChannelFinished() are forwarded, and
+ *    the stream only ends with its readChannelFinished() or close().
+ * Data is processed in chunkSize() pieces, so memory usage does not
+ * depend on the stream size. The output is the same format as
+ * Encryptor::encrypt / Decryptor::decrypt.
+ * In ModeCTR a ReadOnly device over a random access device is random
+ * access too: it supports seek() and size(), and only the bytes
+ * actually read are decrypted. When the wrapped device is a QFile it is
+ * memory mapped instead of read.
+ * ModeCTR needs an algorithm with 16 byte blocks, RC5_32_32_20 fails
+ * with ErrorAlgorithmNotImplemented.
+ */
+class AsemanEncryptedDevicePrivate;
+class LIBASEMANTOOLSSHARED_EXPORT AsemanEncryptedDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    AsemanEncryptedDevice(QIODevice *device, QSharedPointer<AsemanSimpleQtCryptor::Key> key,
+                          AsemanSimpleQtCryptor::Algorithm algorithm = AsemanSimpleQtCryptor::SERPENT_32,
+                          AsemanSimpleQtCryptor::Mode mode = AsemanSimpleQtCryptor::ModeCFB,
+                          QObject *parent = 0);
+    virtual ~AsemanEncryptedDevice();
+
+    QIODevice *device() const;
+
+    void setChunkSize(int size);
+    int chunkSize() const;
+
+    AsemanSimpleQtCryptor::Error error() const;
+
+    virtual bool open(OpenMode mode);
+    virtual void close();
+
+    virtual bool isSequential() const;
+    virtual bool atEnd() const;
+    virtual qint64 bytesAvailable() const;
+    virtual qint64 size() const;
+    virtual bool seek(qint64 pos);
+
+protected:
+    virtual qint64 readData(char *data, qint64 maxlen);
+    virtual qint64 writeData(const char *data, qint64 len);
+
+private:
+    bool fetch();
+    bool sourceAtEnd(bool emptyRead) const;
+    bool openRandomAccess();
+    qint64 readRandomAccess(char *data, qint64 maxlen);
+    void setError(AsemanSimpleQtCryptor::Error error);
+
+private:
+    AsemanEncryptedDevicePrivate *p;
+};
+
+#endif // ASEMANENCRYPTEDDEVICE_H
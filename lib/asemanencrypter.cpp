@@ -16,7 +16,212 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define BATCH_MAGIC "AEB1"
+#define BATCH_MAGIC_SIZE 4
+#define BATCH_NONCE_SIZE 16
+#define BATCH_CHECK_SIZE 8
+#define BATCH_HEADER_SIZE (BATCH_MAGIC_SIZE + BATCH_NONCE_SIZE + BATCH_CHECK_SIZE + 4)
+#define BATCH_SEGMENT_SIZE 256
+#define BATCH_LANES 8
+
 #include "asemanencrypter.h"
+#include "private/asemanencrypterasyncjob.h"
+
+#include <QtEndian>
+#include <QVector>
+#include <QVarLengthArray>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QAtomicInt>
+#include <QQmlEngine>
+
+using namespace AsemanSimpleQtCryptor;
+
+/*
+ * Batch container:
+ *   "AEB1" | nonce (16) | check (8) | count (4) | count * length (4) | records
+ * Every record is Serpent CFB encrypted with its own IV, E(nonce ^ (index+1)),
+ * so no IV or header is stored per record. The check value is E(nonce) and
+ * tells a wrong key apart from a corrupt container.
+ */
+class AsemanEncrypterBatchJob
+{
+public:
+    AsemanEncrypterBatchJob() : next(0), count(0), decrypt(false), serpent(0) {}
+
+    void process(int from, int to) {
+        if(decrypt)
+            decryptRange(from, to);
+        else
+        {
+            for(int i=from; i<to; i+=BATCH_LANES)
+                encryptLanes(i, qMin(to, i + BATCH_LANES));
+        }
+    }
+
+    /*
+     * In decryption the whole keystream input (IV, C0, C1, ...) is known
+     * up front, so the keystream of all records in the range is made by
+     * one call to the multi-block kernel.
+     */
+    void decryptRange(int from, int to) {
+        int blocks = 0;
+        for(int i=from; i<to; i++)
+            blocks += (lengths[i] + 15) / 16;
+
+        QVarLengthArray<uchar, 4096> stream(blocks*16);
+        uchar *dst = stream.data();
+        for(int i=from; i<to; i++)
+        {
+            const int len = lengths[i];
+            if(len == 0)
+                continue;
+
+            const int recordBlocks = (len + 15) / 16;
+            memcpy(dst, ivs + 16*i, 16);
+            memcpy(dst + 16, inputs[i], (recordBlocks-1)*16);
+            dst += recordBlocks*16;
+        }
+
+        serpent_encrypt_blocks(stream.data(), stream.data(), blocks, serpent);
+
+        const uchar *src = stream.data();
+        for(int i=from; i<to; i++)
+        {
+            const int len = lengths[i];
+            const uchar *in = inputs[i];
+            uchar *out = outputs[i];
+            for(int j=0; j<len; j++)
+                out[j] = in[j] ^ src[j];
+            src += ((len + 15) / 16)*16;
+        }
+    }
+
+    /*
+     * CFB encryption is serial inside a record, so up to BATCH_LANES
+     * records are encrypted side by side, one block of each per step.
+     */
+    void encryptLanes(int from, int to) {
+        uchar feedback[BATCH_LANES*16];
+        int lane[BATCH_LANES];
+        int active = 0;
+        for(int i=from; i<to; i++)
+            if(lengths[i])
+                memcpy(feedback + 16*(active++), ivs + 16*i, 16);
+
+        for(int pos=0; active; pos+=16)
+        {
+            int n = 0;
+            for(int i=from; i<to; i++)
+                if(lengths[i] > pos)
+                    lane[n++] = i;
+            active = n;
+            if(!active)
+                break;
+
+            serpent_encrypt_blocks(feedback, feedback, active, serpent);
+            for(int l=0; l<active; l++)
+            {
+                const int idx = lane[l];
+                const int size = qMin(16, lengths[idx] - pos);
+                const uchar *in = inputs[idx] + pos;
+                uchar *out = outputs[idx] + pos;
+                uchar *block = feedback + 16*l;
+                for(int j=0; j<size; j++)
+                    out[j] = block[j] ^= in[j];
+            }
+
+            // compact the lanes of the records that continue
+            int next = 0;
+            for(int l=0; l<active; l++)
+            {
+                if(lengths[lane[l]] <= pos + 16)
+                    continue;
+                if(next != l)
+                    memcpy(feedback + 16*next, feedback + 16*l, 16);
+                next++;
+            }
+        }
+    }
+
+    bool runSegment() {
+        const int segment = next.fetchAndAddOrdered(1);
+        const int from = segment*BATCH_SEGMENT_SIZE;
+        if(from >= count)
+            return false;
+
+        process(from, qMin(count, from + BATCH_SEGMENT_SIZE));
+        return true;
+    }
+
+    QAtomicInt next;
+    QSemaphore finished;
+    int count;
+    bool decrypt;
+    const quint32 *serpent;
+    const uchar *ivs;
+    QVector<const uchar*> inputs;
+    QVector<uchar*> outputs;
+    QVector<int> lengths;
+};
+
+class AsemanEncrypterBatchRunnable: public QRunnable
+{
+public:
+    AsemanEncrypterBatchRunnable(AsemanEncrypterBatchJob *job) : job(job) {}
+    void run() {
+        while(job->runSegment()) {}
+        job->finished.release();
+    }
+
+    AsemanEncrypterBatchJob *job;
+};
+
+static void aseman_encrypter_batch_run(AsemanEncrypterBatchJob &job, bool parallel)
+{
+    int helpers = 0;
+    if(parallel && job.count > BATCH_SEGMENT_SIZE)
+    {
+        const int wanted = qMin(QThread::idealThreadCount(), (job.count + BATCH_SEGMENT_SIZE - 1)/BATCH_SEGMENT_SIZE) - 1;
+        QThreadPool *pool = QThreadPool::globalInstance();
+        for(int i=0; i<wanted; i++)
+        {
+            AsemanEncrypterBatchRunnable *runnable = new AsemanEncrypterBatchRunnable(&job);
+            runnable->setAutoDelete(true);
+            if(!pool->tryStart(runnable))
+            {
+                delete runnable;
+                break;
+            }
+            helpers++;
+        }
+    }
+
+    while(job.runSegment()) {}
+    job.finished.acquire(helpers);
+}
+
+/*
+ * IVs for the records 0..count-1 and the check value, all encrypted at once.
+ * Block 0 is the check value, block i+1 the IV of record i.
+ */
+static QByteArray aseman_encrypter_batch_ivs(const uchar *nonce, int count, const quint32 *serpent)
+{
+    QByteArray result((count+1)*16, Qt::Uninitialized);
+    uchar *blocks = reinterpret_cast<uchar*>(result.data());
+    const quint32 base = qFromLittleEndian<quint32>(nonce + 12);
+    for(int i=0; i<=count; i++)
+    {
+        uchar *block = blocks + 16*i;
+        memcpy(block, nonce, 12);
+        qToLittleEndian<quint32>(base ^ (quint32)i, block + 12);
+    }
+
+    serpent_encrypt_blocks(blocks, blocks, count+1, serpent);
+    return result;
+}
 
 QByteArray AsemanEncrypter::encrypt(const QByteArray &data)
 {
@@ -52,3 +257,182 @@ QString AsemanEncrypter::key() const
 {
     return _keyStr;
 }
+
+QByteArray AsemanEncrypter::encryptBatch(const QList<QByteArray> &records, bool parallel)
+{
+    if(!_key)
+        return QByteArray();
+
+    _key->expandKeySerpent();
+    const int count = records.count();
+
+    int total = BATCH_HEADER_SIZE + 4*count;
+    for(int i=0; i<count; i++)
+        total += records.at(i).size();
+
+    // Every record IV comes from the nonce, so it must never repeat
+    const QByteArray nonce = InitializationVector::getNonce8() + InitializationVector::getNonce8();
+    if(nonce.size() != BATCH_NONCE_SIZE)
+        return QByteArray();
+
+    QByteArray result(total, Qt::Uninitialized);
+    uchar *out = reinterpret_cast<uchar*>(result.data());
+    const QByteArray ivs = aseman_encrypter_batch_ivs(reinterpret_cast<const uchar*>(nonce.constData()), count, _key->serpent);
+
+    memcpy(out, BATCH_MAGIC, BATCH_MAGIC_SIZE);
+    memcpy(out + BATCH_MAGIC_SIZE, nonce.constData(), BATCH_NONCE_SIZE);
+    memcpy(out + BATCH_MAGIC_SIZE + BATCH_NONCE_SIZE, ivs.constData(), BATCH_CHECK_SIZE);
+    qToLittleEndian<quint32>(count, out + BATCH_HEADER_SIZE - 4);
+
+    AsemanEncrypterBatchJob job;
+    job.count = count;
+    job.decrypt = false;
+    job.serpent = _key->serpent;
+    job.ivs = reinterpret_cast<const uchar*>(ivs.constData()) + 16;
+    job.inputs.resize(count);
+    job.outputs.resize(count);
+    job.lengths.resize(count);
+
+    uchar *lengths = out + BATCH_HEADER_SIZE;
+    uchar *payload = lengths + 4*count;
+    for(int i=0; i<count; i++)
+    {
+        const QByteArray &record = records.at(i);
+        qToLittleEndian<quint32>(record.size(), lengths + 4*i);
+        job.inputs[i] = reinterpret_cast<const uchar*>(record.constData());
+        job.outputs[i] = payload;
+        job.lengths[i] = record.size();
+        payload += record.size();
+    }
+
+    aseman_encrypter_batch_run(job, parallel);
+    return result;
+}
+
+bool AsemanEncrypter::decryptBatch(const QByteArray &data, QList<QByteArray> &records, bool parallel)
+{
+    records.clear();
+    if(!_key || data.size() < BATCH_HEADER_SIZE || !data.startsWith(BATCH_MAGIC))
+        return false;
+
+    const uchar *in = reinterpret_cast<const uchar*>(data.constData());
+    const quint32 count = qFromLittleEndian<quint32>(in + BATCH_HEADER_SIZE - 4);
+    if(count > (quint32)(data.size() - BATCH_HEADER_SIZE)/4)
+        return false;
+
+    const uchar *lengths = in + BATCH_HEADER_SIZE;
+    qint64 total = BATCH_HEADER_SIZE + 4*(qint64)count;
+    for(quint32 i=0; i<count; i++)
+        total += qFromLittleEndian<quint32>(lengths + 4*i);
+    if(total != data.size())
+        return false;
+
+    _key->expandKeySerpent();
+    const QByteArray ivs = aseman_encrypter_batch_ivs(in + BATCH_MAGIC_SIZE, count, _key->serpent);
+    if(memcmp(ivs.constData(), in + BATCH_MAGIC_SIZE + BATCH_NONCE_SIZE, BATCH_CHECK_SIZE) != 0)
+        return false;
+
+    AsemanEncrypterBatchJob job;
+    job.count = count;
+    job.decrypt = true;
+    job.serpent = _key->serpent;
+    job.ivs = reinterpret_cast<const uchar*>(ivs.constData()) + 16;
+    job.inputs.resize(count);
+    job.outputs.resize(count);
+    job.lengths.resize(count);
+
+    records.reserve(count);
+    const uchar *payload = lengths + 4*count;
+    for(quint32 i=0; i<count; i++)
+    {
+        const int len = qFromLittleEndian<quint32>(lengths + 4*i);
+        records.append(QByteArray(len, Qt::Uninitialized));
+        job.inputs[i] = payload;
+        job.outputs[i] = reinterpret_cast<uchar*>(records.last().data());
+        job.lengths[i] = len;
+        payload += len;
+    }
+
+    aseman_encrypter_batch_run(job, parallel);
+    return true;
+}
+
+QByteArray AsemanEncrypter::encryptBatch(const QVariantList &records, bool parallel)
+{
+    QList<QByteArray> list;
+    list.reserve(records.count());
+    for(const QVariant &var: records)
+        list << var.toByteArray();
+
+    return encryptBatch(list, parallel);
+}
+
+QVariantList AsemanEncrypter::decryptBatch(const QByteArray &data, bool parallel)
+{
+    QList<QByteArray> list;
+    QVariantList result;
+    if(!decryptBatch(data, list, parallel))
+        return result;
+
+    result.reserve(list.count());
+    for(const QByteArray &record: list)
+        result << record;
+
+    return result;
+}
+
+int AsemanEncrypter::encryptAsync(const QByteArray &data, const QJSValue &callback)
+{
+    return startAsync(data, false, callback);
+}
+
+int AsemanEncrypter::decryptAsync(const QByteArray &data, const QJSValue &callback)
+{
+    return startAsync(data, true, callback);
+}
+
+void AsemanEncrypter::cancel(int job)
+{
+    AsemanEncrypterAsyncJob *asyncJob = _jobs.value(job);
+    if(asyncJob)
+        asyncJob->cancel();
+}
+
+int AsemanEncrypter::startAsync(const QByteArray &data, bool decrypt, const QJSValue &callback)
+{
+    if(!_key)
+        return 0;
+
+    // The key is expanded here, so workers never race on the lazy expansion
+    _key->expandKeySerpent();
+
+    _lastJob++;
+    const int id = _lastJob;
+    AsemanEncrypterAsyncJob *asyncJob = new AsemanEncrypterAsyncJob(id, _key, data, decrypt);
+    _jobs[id] = asyncJob;
+
+    QQmlEngine *engine = qmlEngine(this);
+    const bool hasCallback = (callback.isCallable() && !callback.isNull() && engine);
+
+    connect(asyncJob, &AsemanEncrypterAsyncJob::progress, this, &AsemanEncrypter::asyncProgress);
+    connect(asyncJob, &AsemanEncrypterAsyncJob::canceled, this, [this](int job){
+        _jobs.remove(job);
+        Q_EMIT asyncCanceled(job);
+    });
+    connect(asyncJob, &AsemanEncrypterAsyncJob::finished, this, [this, engine, hasCallback, callback](int job, const QByteArray &result){
+        _jobs.remove(job);
+        if(hasCallback)
+            QJSValue(callback).call( QJSValueList()<<engine->toScriptValue<QByteArray>(result) );
+        Q_EMIT asyncFinished(job, result);
+    });
+
+    asyncJob->start();
+    return id;
+}
+
+AsemanEncrypter::~AsemanEncrypter()
+{
+    for(const QPointer<AsemanEncrypterAsyncJob> &job: _jobs)
+        if(job)
+            job->cancel();
+}
@@ -21,30 +21,55 @@
 
 #include "asemansimpleqtcryptor.h"
 
+#include <QList>
+#include <QVariantList>
+#include <QHash>
+#include <QPointer>
+#include <QJSValue>
+
 #include "asemantools_global.h"
 
+class AsemanEncrypterAsyncJob;
 class LIBASEMANTOOLSSHARED_EXPORT AsemanEncrypter : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(QString key READ key WRITE setKey NOTIFY keyChanged)
 
 public:
-    AsemanEncrypter(QObject *parent = 0): QObject(parent){}
-    virtual ~AsemanEncrypter(){}
+    AsemanEncrypter(QObject *parent = 0): QObject(parent), _lastJob(0){}
+    virtual ~AsemanEncrypter();
 
     void setKey(const QString &key);
     QString key() const;
 
+    QByteArray encryptBatch(const QList<QByteArray> &records, bool parallel = false);
+    bool decryptBatch(const QByteArray &data, QList<QByteArray> &records, bool parallel = false);
+
 public Q_SLOTS:
     QByteArray encrypt(const QByteArray &data);
     QByteArray decrypt(const QByteArray &data);
 
+    QByteArray encryptBatch(const QVariantList &records, bool parallel = false);
+    QVariantList decryptBatch(const QByteArray &data, bool parallel = false);
+
+    int encryptAsync(const QByteArray &data, const QJSValue &callback = QJSValue());
+    int decryptAsync(const QByteArray &data, const QJSValue &callback = QJSValue());
+    void cancel(int job);
+
 Q_SIGNALS:
     void keyChanged();
+    void asyncProgress(int job, qreal progress);
+    void asyncFinished(int job, const QByteArray &result);
+    void asyncCanceled(int job);
+
+private:
+    int startAsync(const QByteArray &data, bool decrypt, const QJSValue &callback);
 
 private:
     QString _keyStr;
     QSharedPointer<AsemanSimpleQtCryptor::Key> _key;
+    QHash<int, QPointer<AsemanEncrypterAsyncJob> > _jobs;
+    int _lastJob;
 };
 
 #endif // ASEMANENCRYPTER_H
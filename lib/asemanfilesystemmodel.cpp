@@ -16,12 +16,16 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define RESET_MIN_CHANGES 256
+#define ATTRIBUTES_CHUNK 64
+
 #include "asemanfilesystemmodel.h"
+#include "private/asemanfilesystemenumerator.h"
+#include "private/asemanfilesystemattributes.h"
 
 #include <QFileSystemWatcher>
 #include <QDir>
 #include <QMimeData>
-#include <QMimeDatabase>
 #include <QMimeType>
 #include <QDateTime>
 #include <QFileInfo>
@@ -29,6 +33,11 @@
 #include <QTimer>
 #include <QDebug>
 #include <QUrl>
+#include <QHash>
+#include <QSet>
+#include <QPointer>
+
+#include <algorithm>
 
 
 class AsemanFileSystemModelPrivate
@@ -44,93 +53,25 @@ public:
     int sortField;
 
     QList<QFileInfo> list;
-    QMimeDatabase mdb;
+    QHash<QString, int> rows;
 
     QFileSystemWatcher *watcher;
     QTimer *refresh_timer;
-};
 
-class SortUnitType
-{
-public:
-    SortUnitType(): num(0){}
-    QChar ch;
-    quint64 num;
+    QPointer<AsemanFileSystemEnumerator> enumerator;
+    bool loading;
+
+    // Attributes that need I/O, loaded for the rows the view asks for
+    QHash<QString, AsemanFileSystemAttributes> attributes;
+    QSet<QString> attributesStale;
+    QSet<QString> attributesRequested;
+    QStringList attributesQueue;
+    QList< QPointer<AsemanFileSystemAttributesLoader> > attributesLoaders;
+    int attributesGeneration;
+    QTimer *attributes_timer;
+    bool attributesOutdated;
 };
 
-QList<SortUnitType> aseman_analize_file_name(const QString &fileName)
-{
-    QList<SortUnitType> res;
-    for(int i=0; i<fileName.length(); i++)
-    {
-        const QChar &ch = fileName[i];
-        if(ch.isNumber())
-        {
-            int num = QString(ch).toInt();
-            if(res.isEmpty() || !res.last().ch.isNull() )
-                res << SortUnitType();
-
-            SortUnitType & resUnit = res[res.length()-1];
-            resUnit.num = resUnit.num*10 + num;
-        }
-        else
-        {
-            SortUnitType unit;
-            unit.ch = ch;
-            res << unit;
-        }
-    }
-
-    return res;
-}
-
-AsemanFileSystemModelPrivate *fileListSort_private_data = 0;
-bool aseman_fileListSort(const QFileInfo &f1, const QFileInfo &f2)
-{
-    if(fileListSort_private_data->showDirsFirst)
-    {
-        if(f1.isDir() && !f2.isDir())
-            return true;
-        if(!f1.isDir() && f2.isDir())
-            return false;
-    }
-
-    const QString & s1 = f1.fileName();
-    const QString & s2 = f2.fileName();
-
-    const QList<SortUnitType> &ul1 = aseman_analize_file_name(s1);
-    const QList<SortUnitType> &ul2 = aseman_analize_file_name(s2);
-
-    for(int i=0; i<ul1.length() && i<ul2.length(); i++)
-    {
-        const SortUnitType &u1 = ul1.at(i);
-        const SortUnitType &u2 = ul2.at(i);
-
-        if(u1.ch.isNull() && !u2.ch.isNull())
-            return true;
-        if(!u1.ch.isNull() && u2.ch.isNull())
-            return false;
-        if(!u1.ch.isNull() && !u2.ch.isNull())
-        {
-            if(u1.ch < u2.ch)
-                return true;
-            if(u1.ch > u2.ch)
-                return false;
-        }
-        if(u1.ch.isNull() && u2.ch.isNull())
-        {
-            if(u1.num < u2.num)
-                return true;
-            if(u1.num > u2.num)
-                return false;
-        }
-    }
-
-    return ul1.length() < ul2.length();
-}
-
-
-
 AsemanFileSystemModel::AsemanFileSystemModel(QObject *parent) :
     AsemanAbstractListModel(parent)
 {
@@ -140,18 +81,32 @@ AsemanFileSystemModel::AsemanFileSystemModel(QObject *parent) :
     p->showDirsFirst = true;
     p->showFiles = true;
     p->showHidden = false;
-    p->sortField = AsemanFileSystemModel::Size;
+    p->sortField = AsemanFileSystemModel::Name;
     p->refresh_timer = 0;
+    p->loading = false;
+    p->attributesGeneration = 0;
+    p->attributesOutdated = false;
 
     p->watcher = new QFileSystemWatcher(this);
 
     p->refresh_timer = new QTimer(this);
     p->refresh_timer->setInterval(10);
 
-    connect(p->watcher, &QFileSystemWatcher::directoryChanged, this, &AsemanFileSystemModel::refresh);
-    connect(p->watcher, &QFileSystemWatcher::fileChanged, this, &AsemanFileSystemModel::refresh);
+    p->attributes_timer = new QTimer(this);
+    p->attributes_timer->setInterval(0);
+
+    // Only a change on the disk makes the loaded attributes outdated
+    connect(p->watcher, &QFileSystemWatcher::directoryChanged, this, [this](){
+        p->attributesOutdated = true;
+        refresh();
+    });
+    connect(p->watcher, &QFileSystemWatcher::fileChanged, this, [this](){
+        p->attributesOutdated = true;
+        refresh();
+    });
 
     connect(p->refresh_timer, &QTimer::timeout, this, &AsemanFileSystemModel::reinit_buffer);
+    connect(p->attributes_timer, &QTimer::timeout, this, &AsemanFileSystemModel::load_attributes);
 }
 
 void AsemanFileSystemModel::setShowDirs(bool stt)
@@ -262,6 +217,21 @@ void AsemanFileSystemModel::setFolder(const QString &url)
     if(!p->folder.isEmpty())
         p->watcher->addPath(p->folder);
 
+    // The new folder is published in batches while it is listed
+    if(p->enumerator)
+        p->enumerator->cancel();
+    p->enumerator = 0;
+    if(!p->list.isEmpty())
+    {
+        beginResetModel();
+        p->list.clear();
+        p->rows.clear();
+        endResetModel();
+        Q_EMIT countChanged();
+        Q_EMIT listChanged();
+    }
+
+    clearAttributes();
     Q_EMIT folderChanged();
 
     refresh();
@@ -280,7 +250,12 @@ void AsemanFileSystemModel::setSortField(int field)
     p->sortField = field;
     Q_EMIT sortFieldChanged();
 
-    refresh();
+    // A running listing is restarted with the new field, otherwise
+    // the shown entries are only sorted again.
+    if(p->enumerator || p->refresh_timer->isActive())
+        refresh();
+    else
+        startEnumerator(new AsemanFileSystemEnumerator(p->list, p->attributes, p->sortField, p->showDirsFirst));
 }
 
 int AsemanFileSystemModel::sortField() const
@@ -288,6 +263,11 @@ int AsemanFileSystemModel::sortField() const
     return p->sortField;
 }
 
+bool AsemanFileSystemModel::loading() const
+{
+    return p->loading;
+}
+
 QString AsemanFileSystemModel::parentFolder() const
 {
     return QFileInfo(p->folder).dir().absolutePath();
@@ -323,11 +303,17 @@ QVariant AsemanFileSystemModel::data(const QModelIndex &index, int role) const
         break;
 
     case FileMime:
-        result = p->mdb.mimeTypeForFile(info.filePath()).name();
+    {
+        const AsemanFileSystemAttributes *attr = attributes(info);
+        result = attr? attr->mime : AsemanFileSystemAttributesLoader::mimeByName(info.fileName(), info.isDir());
+    }
         break;
 
     case FileSize:
-        result = info.size();
+    {
+        const AsemanFileSystemAttributes *attr = attributes(info);
+        result = attr? attr->size : qint64(0);
+    }
         break;
 
     case FileSuffix:
@@ -343,11 +329,17 @@ QVariant AsemanFileSystemModel::data(const QModelIndex &index, int role) const
         break;
 
     case FileModifiedDate:
-        result = info.lastModified();
+    {
+        const AsemanFileSystemAttributes *attr = attributes(info);
+        result = attr? attr->modified : QDateTime();
+    }
         break;
 
     case FileCreatedDate:
-        result = info.created();
+    {
+        const AsemanFileSystemAttributes *attr = attributes(info);
+        result = attr? attr->created : QDateTime();
+    }
         break;
     }
 
@@ -400,97 +392,292 @@ void AsemanFileSystemModel::reinit_buffer()
     if(p->showHidden)
         filter = filter | QDir::Hidden;
 
-    QStringList list;
-    if(filter && !p->folder.isEmpty())
-        list = QDir(p->folder).entryList(static_cast<QDir::Filter>(filter));
+    // Batches are only appended to an empty list, a refresh of a shown
+    // folder waits for the whole list and applies the difference.
+    startEnumerator(new AsemanFileSystemEnumerator(p->folder, filter, p->nameFilters, p->sortField,
+                                                   p->showDirsFirst, p->list.isEmpty()));
+}
+
+void AsemanFileSystemModel::startEnumerator(AsemanFileSystemEnumerator *enumerator)
+{
+    if(p->enumerator)
+        p->enumerator->cancel();
 
-    QList<QFileInfo> res;
-    for(const QString &fileName: list)
-        res << QFileInfo(p->folder + "/" + fileName);
+    connect(enumerator, &AsemanFileSystemEnumerator::batch, this, [this, enumerator](const QList<QFileInfo> &list){
+        if(p->enumerator != enumerator || list.isEmpty())
+            return;
 
-    if(!p->nameFilters.isEmpty())
-        for(int i=0; i<res.count(); i++)
-        {
-            const QFileInfo &inf = res.at(i);
-
-            QStringList suffixes;
-            if(!inf.suffix().isEmpty())
-                suffixes << inf.suffix();
-            else
-                suffixes = p->mdb.mimeTypeForFile(inf.filePath()).suffixes();
-
-            bool founded = inf.isDir();
-            for(const QString &sfx: suffixes)
-                if(p->nameFilters.contains("*."+sfx, Qt::CaseInsensitive))
-                {
-                    founded = true;
-                    break;
-                }
-
-            if(!founded)
+        beginInsertRows(QModelIndex(), p->list.count(), p->list.count()+list.count()-1);
+        // The row hash is only extended when it is built already
+        if(!p->rows.isEmpty())
+            for(int i=0; i<list.count(); i++)
+                p->rows.insert(list.at(i).filePath(), p->list.count()+i);
+
+        p->list.append(list);
+        endInsertRows();
+
+        Q_EMIT countChanged();
+        Q_EMIT listChanged();
+    });
+    connect(enumerator, &AsemanFileSystemEnumerator::finished, this, [this, enumerator](const QList<QFileInfo> &list){
+        if(p->enumerator != enumerator)
+            return;
+
+        p->enumerator = 0;
+        changed(list);
+        setLoading(false);
+    });
+
+    p->enumerator = enumerator;
+    setLoading(true);
+    enumerator->start();
+}
+
+/*
+ * The cached attributes of a row, or 0 when they are not loaded yet.
+ * Missing and outdated ones are queued for a loader, so the view never
+ * waits for the disk.
+ */
+const AsemanFileSystemAttributes *AsemanFileSystemModel::attributes(const QFileInfo &info) const
+{
+    const QString &path = info.filePath();
+    QHash<QString, AsemanFileSystemAttributes>::const_iterator i = p->attributes.constFind(path);
+    const bool stale = (i == p->attributes.constEnd() || p->attributesStale.contains(path));
+    if(stale && !p->attributesRequested.contains(path))
+    {
+        p->attributesStale.remove(path);
+        p->attributesRequested.insert(path);
+        p->attributesQueue << path;
+        if(!p->attributes_timer->isActive())
+            p->attributes_timer->start();
+    }
+
+    return i == p->attributes.constEnd()? 0 : &i.value();
+}
+
+void AsemanFileSystemModel::load_attributes()
+{
+    p->attributes_timer->stop();
+
+    const int generation = p->attributesGeneration;
+    for(int i=0; i<p->attributesQueue.count(); i+=ATTRIBUTES_CHUNK)
+    {
+        AsemanFileSystemAttributesLoader *loader = new AsemanFileSystemAttributesLoader(p->attributesQueue.mid(i, ATTRIBUTES_CHUNK));
+        connect(loader, &AsemanFileSystemAttributesLoader::loaded, this, [this, generation](const QList<AsemanFileSystemAttributes> &list){
+            if(generation != p->attributesGeneration)
+                return;
+
+            QSet<QString> paths;
+            for(const AsemanFileSystemAttributes &attr: list)
             {
-                res.removeAt(i);
-                i--;
+                p->attributes[attr.path] = attr;
+                p->attributesRequested.remove(attr.path);
+                paths.insert(attr.path);
             }
-        }
 
-    fileListSort_private_data = p;
-    qStableSort(res.begin(), res.end(), aseman_fileListSort);
+            attributesChanged(paths);
+        });
+
+        p->attributesLoaders << loader;
+        loader->start();
+    }
 
-    changed(res);
+    p->attributesQueue.clear();
+    p->attributesLoaders.removeAll(0);
 }
 
-void AsemanFileSystemModel::changed(const QList<QFileInfo> &list)
+/*
+ * One dataChanged for every contiguous range of rows that got new
+ * attributes. The rows are found with a path hash, that is built on
+ * the first use after the list changed.
+ */
+void AsemanFileSystemModel::attributesChanged(const QSet<QString> &paths)
 {
-    bool count_changed = (list.count()==p->list.count());
+    static const QVector<int> roles = QVector<int>() << FileMime << FileSize << FileModifiedDate << FileCreatedDate;
 
-    for( int i=0 ; i<p->list.count() ; i++ )
+    if(p->rows.isEmpty())
     {
-        const QFileInfo &file = p->list.at(i);
-        if( list.contains(file) )
-            continue;
-
-        beginRemoveRows(QModelIndex(), i, i);
-        p->list.removeAt(i);
-        i--;
-        endRemoveRows();
+        p->rows.reserve(p->list.count());
+        for(int i=0; i<p->list.count(); i++)
+            p->rows.insert(p->list.at(i).filePath(), i);
     }
 
-    QList<QFileInfo> temp_list = list;
-    for( int i=0 ; i<temp_list.count() ; i++ )
+    QVector<int> rows;
+    rows.reserve(paths.count());
+    for(const QString &path: paths)
     {
-        const QFileInfo &file = temp_list.at(i);
-        if( p->list.contains(file) )
-            continue;
+        const int row = p->rows.value(path, -1);
+        if(row != -1)
+            rows << row;
+    }
 
-        temp_list.removeAt(i);
-        i--;
+    std::sort(rows.begin(), rows.end());
+    for(int i=0; i<rows.count(); i++)
+    {
+        int last = i;
+        while(last+1 < rows.count() && rows.at(last+1) == rows.at(last)+1)
+            last++;
+
+        Q_EMIT dataChanged(index(rows.at(i)), index(rows.at(last)), roles);
+        i = last;
     }
-    while( p->list != temp_list )
-        for( int i=0 ; i<p->list.count() ; i++ )
+}
+
+void AsemanFileSystemModel::clearAttributes()
+{
+    for(AsemanFileSystemAttributesLoader *loader: p->attributesLoaders)
+        if(loader)
+            loader->cancel();
+
+    p->attributesLoaders.clear();
+    p->attributes.clear();
+    p->attributesStale.clear();
+    p->attributesRequested.clear();
+    p->attributesQueue.clear();
+    p->attributesGeneration++;
+}
+
+void AsemanFileSystemModel::setLoading(bool loading)
+{
+    if(p->loading == loading)
+        return;
+
+    p->loading = loading;
+    Q_EMIT loadingChanged();
+}
+
+/*
+ * Applies the new list with a path hash instead of searching the lists.
+ * Removed and inserted entries are announced as contiguous ranges, and
+ * a changed order of the kept entries as one layout change. When most
+ * of a big folder changed, the model is reset instead.
+ */
+void AsemanFileSystemModel::changed(const QList<QFileInfo> &list)
+{
+    const int oldCount = p->list.count();
+
+    QHash<QString, int> newRows;
+    newRows.reserve(list.count());
+    for(int i=0; i<list.count(); i++)
+        newRows.insert(list.at(i).filePath(), i);
+
+    QVector<bool> removed(oldCount, false);
+    QSet<QString> kept;
+    kept.reserve(oldCount);
+    int removedCount = 0;
+    for(int i=0; i<oldCount; i++)
+    {
+        const QString &path = p->list.at(i).filePath();
+        if(newRows.contains(path))
+            kept.insert(path);
+        else
         {
-            const QFileInfo &file = p->list.at(i);
-            int nw = temp_list.indexOf(file);
-            if( i == nw )
-                continue;
+            removed[i] = true;
+            removedCount++;
+        }
+    }
 
-            beginMoveRows( QModelIndex(), i, i, QModelIndex(), nw>i?nw+1:nw );
-            p->list.move( i, nw );
-            endMoveRows();
+    // Attributes of the kept entries are shown until they are reloaded.
+    // A sort or filter change lists the same files, so they are only
+    // reloaded after the watcher reported a change.
+    const bool outdated = p->attributesOutdated;
+    p->attributesOutdated = false;
+    for(QHash<QString, AsemanFileSystemAttributes>::iterator i = p->attributes.begin(); i != p->attributes.end(); )
+    {
+        if(!newRows.contains(i.key()))
+            i = p->attributes.erase(i);
+        else
+        {
+            if(outdated)
+                p->attributesStale.insert(i.key());
+            ++i;
         }
+    }
+
+    p->rows.clear();
 
-    for( int i=0 ; i<list.count() ; i++ )
+    const int insertedCount = list.count() - kept.count();
+    const int changes = removedCount + insertedCount;
+    if(changes > RESET_MIN_CHANGES && changes*2 > qMax(oldCount, list.count()))
+    {
+        beginResetModel();
+        p->list = list;
+        endResetModel();
+    }
+    else
     {
-        const QFileInfo &file = list.at(i);
-        if( p->list.contains(file) )
-            continue;
+        // Removes from the end, so the rows before stay valid
+        for(int i=oldCount-1; i>=0; i--)
+        {
+            if(!removed.at(i))
+                continue;
 
-        beginInsertRows(QModelIndex(), i, i );
-        p->list.insert( i, file );
-        endInsertRows();
+            int first = i;
+            while(first > 0 && removed.at(first-1))
+                first--;
+
+            beginRemoveRows(QModelIndex(), first, i);
+            p->list.erase(p->list.begin()+first, p->list.begin()+i+1);
+            endRemoveRows();
+            i = first;
+        }
+
+        QList<QFileInfo> ordered;
+        ordered.reserve(kept.count());
+        for(const QFileInfo &file: list)
+            if(kept.contains(file.filePath()))
+                ordered << file;
+
+        bool reordered = false;
+        for(int i=0; i<ordered.count() && !reordered; i++)
+            reordered = (ordered.at(i).filePath() != p->list.at(i).filePath());
+
+        if(reordered)
+        {
+            Q_EMIT layoutAboutToBeChanged();
+
+            QHash<QString, int> orderedRows;
+            orderedRows.reserve(ordered.count());
+            for(int i=0; i<ordered.count(); i++)
+                orderedRows.insert(ordered.at(i).filePath(), i);
+
+            const QModelIndexList &from = persistentIndexList();
+            QModelIndexList to;
+            for(const QModelIndex &idx: from)
+                to << index(orderedRows.value(p->list.at(idx.row()).filePath()));
+
+            // The kept entries keep their old QFileInfo, as they did before
+            QList<QFileInfo> moved;
+            moved.reserve(ordered.count());
+            QVector<int> oldRows(ordered.count());
+            for(int i=0; i<p->list.count(); i++)
+                oldRows[orderedRows.value(p->list.at(i).filePath())] = i;
+            for(int row: oldRows)
+                moved << p->list.at(row);
+
+            p->list = moved;
+            changePersistentIndexList(from, to);
+            Q_EMIT layoutChanged();
+        }
+
+        for(int i=0; i<list.count(); i++)
+        {
+            if(kept.contains(list.at(i).filePath()))
+                continue;
+
+            int last = i;
+            while(last+1 < list.count() && !kept.contains(list.at(last+1).filePath()))
+                last++;
+
+            beginInsertRows(QModelIndex(), i, last);
+            for(int j=i; j<=last; j++)
+                p->list.insert(j, list.at(j));
+            endInsertRows();
+            i = last;
+        }
     }
 
-    if(count_changed)
+    if(oldCount != p->list.count())
         Q_EMIT countChanged();
 
     Q_EMIT listChanged();
@@ -498,5 +685,10 @@ void AsemanFileSystemModel::changed(const QList<QFileInfo> &list)
 
 AsemanFileSystemModel::~AsemanFileSystemModel()
 {
+    if(p->enumerator)
+        p->enumerator->cancel();
+
+    clearAttributes();
+
     delete p;
 }
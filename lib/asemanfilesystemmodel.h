@@ -22,9 +22,12 @@
 #include "asemanabstractlistmodel.h"
 #include <QStringList>
 #include <QFileInfo>
+#include <QSet>
 
 #include "asemantools_global.h"
 
+class AsemanFileSystemAttributes;
+class AsemanFileSystemEnumerator;
 class AsemanFileSystemModelPrivate;
 class LIBASEMANTOOLSSHARED_EXPORT AsemanFileSystemModel : public AsemanAbstractListModel
 {
@@ -42,12 +45,15 @@ class LIBASEMANTOOLSSHARED_EXPORT AsemanFileSystemModel : public AsemanAbstractL
     Q_PROPERTY(QString parentFolder READ parentFolder NOTIFY parentFolderChanged)
     Q_PROPERTY(int sortField READ sortField WRITE setSortField NOTIFY sortFieldChanged)
     Q_PROPERTY(int count READ count NOTIFY countChanged)
+    Q_PROPERTY(bool loading READ loading NOTIFY loadingChanged)
 
 public:
     enum SortFlag {
         Name,
         Size,
-        Date
+        Date,
+        CreatedDate,
+        Type
     };
 
     enum DataRole {
@@ -90,6 +96,8 @@ public:
     void setSortField(int field);
     int sortField() const;
 
+    bool loading() const;
+
     QString parentFolder() const;
 
     const QFileInfo &id( const QModelIndex &index ) const;
@@ -114,13 +122,20 @@ Q_SIGNALS:
     void folderChanged();
     void parentFolderChanged();
     void sortFieldChanged();
+    void loadingChanged();
     void listChanged();
 
 private Q_SLOTS:
     void reinit_buffer();
+    void load_attributes();
 
 private:
     void changed(const QList<QFileInfo> &list);
+    void setLoading(bool loading);
+    void startEnumerator(AsemanFileSystemEnumerator *enumerator);
+    const AsemanFileSystemAttributes *attributes(const QFileInfo &info) const;
+    void attributesChanged(const QSet<QString> &paths);
+    void clearAttributes();
 
 private:
     AsemanFileSystemModelPrivate *p;
@@ -16,29 +16,52 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#define MAX_ACTIVE_THREADS 4
 #define IMAGE_WIDTH 400
+#define PALETTE_SIZE 6
+#define MEMORY_CACHE_SIZE 2048
+#define DISK_CACHE_SIZE 16384
+#define DISK_CACHE_MAGIC 0x41434332
+#define DISK_CACHE_FILE "/imagecolors.cache"
 
 #include "asemanimagecoloranalizor.h"
 #include "asemandevices.h"
+#include "asemanapplication.h"
+#include "private/asemanimagecolorkernel.h"
+#include "private/asemanimagedecodestrategy.h"
+#include "private/asemanimageheader.h"
 
 #include <QThread>
+#include <QThreadPool>
 #include <QCoreApplication>
-#include <QQueue>
+#include <QPointer>
+#include <QMap>
 #include <QSet>
-#include <QImageReader>
+#include <QCache>
 #include <QImage>
 #include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QDebug>
 
-AsemanImageColorAnalizorThread *colorizor_thread = 0;
+#include <algorithm>
+
+QPointer<AsemanImageColorAnalizorThread> colorizor_thread;
+
+typedef QPair<int,QString> AsemanImageColorAnalizorKey;
 
 class AsemanImageColorAnalizorPrivate
 {
 public:
     QUrl source;
     QColor color;
+    QList<QColor> palette;
     int method;
+
+    bool requested;
+    AsemanImageColorAnalizorKey request;
 };
 
 AsemanImageColorAnalizor::AsemanImageColorAnalizor(QObject *parent) :
@@ -46,11 +69,10 @@ AsemanImageColorAnalizor::AsemanImageColorAnalizor(QObject *parent) :
 {
     p = new AsemanImageColorAnalizorPrivate;
     p->method = Normal;
+    p->requested = false;
 
     if( !colorizor_thread )
         colorizor_thread = new AsemanImageColorAnalizorThread(QCoreApplication::instance());
-
-    connect( colorizor_thread, &AsemanImageColorAnalizorThread::found, this, &AsemanImageColorAnalizor::found);
 }
 
 QUrl AsemanImageColorAnalizor::source() const
@@ -100,120 +122,354 @@ QColor AsemanImageColorAnalizor::color() const
     return p->color;
 }
 
-void AsemanImageColorAnalizor::found(int method, const QString &path)
+QVariantList AsemanImageColorAnalizor::palette() const
+{
+    QVariantList result;
+    for(const QColor &color: p->palette)
+        result << color;
+
+    return result;
+}
+
+void AsemanImageColorAnalizor::found(int method, const QString &path, const QList<QColor> &colors)
 {
-    if( method != p->method )
+    // It may have requested something else meanwhile
+    if( !p->requested || p->request != AsemanImageColorAnalizorKey(method, path) )
         return;
-    if( path != sourceString() )
+
+    p->requested = false;
+    setColors(colors);
+}
+
+void AsemanImageColorAnalizor::start()
+{
+    release();
+    if( p->source.isEmpty() )
         return;
 
-    const QHash<int, QHash<QString,QColor> > & results = colorizor_thread->results();
-    if( !results.contains(p->method) || !results.value(p->method).contains(sourceString()) )
+    const QString & path = sourceString();
+    QList<QColor> colors;
+    if( colorizor_thread->lookup(p->method, path, colors) )
+    {
+        setColors(colors);
         return;
+    }
+
+    p->request = AsemanImageColorAnalizorKey(p->method, path);
+    p->requested = true;
+    colorizor_thread->analize(this, p->method, path);
+}
 
-    p->color = results[p->method][sourceString()];
+/*
+ * The first color of the result is the color, and the whole result is
+ * the palette. Normal and MoreSaturation give a single color.
+ */
+void AsemanImageColorAnalizor::setColors(const QList<QColor> &colors)
+{
+    p->color = colors.value(0);
+    p->palette = colors;
     Q_EMIT colorChanged();
+    Q_EMIT paletteChanged();
 }
 
-void AsemanImageColorAnalizor::start()
+void AsemanImageColorAnalizor::release()
 {
-    if( p->source.isEmpty() )
+    if( !p->requested )
         return;
 
-    colorizor_thread->analize(p->method, sourceString());
-    found(p->method,sourceString());
+    p->requested = false;
+    if( colorizor_thread )
+        colorizor_thread->release(this, p->request.first, p->request.second);
 }
 
 AsemanImageColorAnalizor::~AsemanImageColorAnalizor()
 {
+    release();
     delete p;
 }
 
 
+/*
+ * Append only file of the analysis results. Later records of the same
+ * (method, path) override the earlier ones, and the file is rewritten
+ * without them when it grows too much.
+ * It is only used by the analysis jobs on the pool, the first one loads
+ * the file. The GUI thread only looks into the memory results, and
+ * gives the file name before any job starts.
+ */
+class AsemanImageColorAnalizorDiskCache
+{
+public:
+    class Entry
+    {
+    public:
+        qint64 size;
+        qint64 modified;
+        QList<QRgb> rgba;
+        quint64 order;
+    };
+
+    AsemanImageColorAnalizorDiskCache() : loaded(false), records(0), order(0) {}
+
+    void setFileName(const QString &fileName) {
+        QMutexLocker locker(&mutex);
+        if( !loaded )
+            file.setFileName(fileName);
+    }
+
+    bool find(const AsemanImageColorAnalizorKey &key, qint64 size, qint64 modified, QList<QColor> &colors) {
+        QMutexLocker locker(&mutex);
+        load();
+        QHash<AsemanImageColorAnalizorKey, Entry>::const_iterator i = entries.constFind(key);
+        if( i == entries.constEnd() || i.value().size != size || i.value().modified != modified )
+            return false;
+
+        colors.clear();
+        for(QRgb rgba: i.value().rgba)
+            colors << QColor::fromRgba(rgba);
+        return true;
+    }
+
+    void insert(const AsemanImageColorAnalizorKey &key, qint64 size, qint64 modified, const QList<QColor> &colors) {
+        QMutexLocker locker(&mutex);
+        load();
+
+        Entry entry;
+        entry.size = size;
+        entry.modified = modified;
+        for(const QColor &color: colors)
+            entry.rgba << color.rgba();
+        entry.order = ++order;
+        entries[key] = entry;
+
+        if( entries.count() > DISK_CACHE_SIZE )
+        {
+            compact();
+            return;
+        }
+
+        if( !file.isOpen() )
+            return;
+
+        QDataStream stream(&file);
+        stream.setVersion(QDataStream::Qt_5_0);
+        write(stream, key, entry);
+        file.flush();
+        records++;
+    }
+
+private:
+    void load() {
+        if( loaded )
+            return;
+
+        loaded = true;
+        if( file.fileName().isEmpty() )
+            return;
+
+        if( file.open(QFile::ReadOnly) )
+        {
+            QDataStream stream(&file);
+            stream.setVersion(QDataStream::Qt_5_0);
+
+            quint32 magic = 0;
+            stream >> magic;
+            while( magic == DISK_CACHE_MAGIC && !stream.atEnd() )
+            {
+                QString path;
+                qint32 method;
+                Entry entry;
+                stream >> path >> method >> entry.size >> entry.modified >> entry.rgba;
+                if( stream.status() != QDataStream::Ok )
+                    break;
+
+                entry.order = ++order;
+                entries[AsemanImageColorAnalizorKey(method, path)] = entry;
+                records++;
+            }
+            file.close();
+        }
+
+        // Rewritten when there is no valid file, or it is mostly old records
+        if( records == 0 || records > 2*entries.count() || entries.count() > DISK_CACHE_SIZE )
+            compact();
+        else
+            file.open(QFile::WriteOnly | QFile::Append);
+    }
+
+    /*
+     * Writes the newest DISK_CACHE_SIZE*3/4 entries to a new file, so
+     * the cache does not have to be compacted on every insert.
+     */
+    void compact() {
+        QList< QPair<quint64, AsemanImageColorAnalizorKey> > order_list;
+        order_list.reserve(entries.count());
+        for(QHash<AsemanImageColorAnalizorKey, Entry>::const_iterator i=entries.constBegin(); i!=entries.constEnd(); i++)
+            order_list << QPair<quint64, AsemanImageColorAnalizorKey>(i.value().order, i.key());
+
+        if( entries.count() > DISK_CACHE_SIZE )
+        {
+            std::sort(order_list.begin(), order_list.end());
+            const int drop = entries.count() - DISK_CACHE_SIZE*3/4;
+            for(int i=0; i<drop; i++)
+                entries.remove(order_list.at(i).second);
+            order_list = order_list.mid(drop);
+        }
+
+        file.close();
+        if( !file.open(QFile::WriteOnly | QFile::Truncate) )
+            return;
+
+        QDataStream stream(&file);
+        stream.setVersion(QDataStream::Qt_5_0);
+        stream << quint32(DISK_CACHE_MAGIC);
+        for(const QPair<quint64, AsemanImageColorAnalizorKey> &item: order_list)
+            write(stream, item.second, entries.value(item.second));
+
+        file.flush();
+        records = entries.count();
+    }
+
+    static void write(QDataStream &stream, const AsemanImageColorAnalizorKey &key, const Entry &entry) {
+        stream << key.second << qint32(key.first) << entry.size << entry.modified << entry.rgba;
+    }
+
+    QMutex mutex;
+    QFile file;
+    QHash<AsemanImageColorAnalizorKey, Entry> entries;
+    bool loaded;
+    int records;
+    quint64 order;
+};
+
+static AsemanImageColorAnalizorDiskCache *aseman_image_color_disk_cache()
+{
+    static AsemanImageColorAnalizorDiskCache *instance = new AsemanImageColorAnalizorDiskCache;
+    return instance;
+}
+
+
 class AsemanImageColorAnalizorThreadPrivate
 {
 public:
-    QHash<int, QHash<QString,QColor> > results;
+    QCache<AsemanImageColorAnalizorKey, QList<QColor> > results;
+
+    // order -> job, the last item runs first
+    QMap<quint64, AsemanImageColorAnalizorKey> queue;
+    QHash<AsemanImageColorAnalizorKey, quint64> queued;
+    QHash<AsemanImageColorAnalizorKey, QList<AsemanImageColorAnalizor*> > subscribers;
+    QSet<AsemanImageColorAnalizorKey> running;
+    quint64 order;
 
-    QQueue< QPair<int,QString> > queue;
-    QSet<AsemanImageColorAnalizorCore*> cores;
-    QQueue<AsemanImageColorAnalizorCore*> free_cores;
+    QThreadPool *pool;
 };
 
 AsemanImageColorAnalizorThread::AsemanImageColorAnalizorThread(QObject *parent) :
     QObject(parent)
 {
+    qRegisterMetaType< QList<QColor> >("QList<QColor>");
+
     p = new AsemanImageColorAnalizorThreadPrivate;
+    p->results.setMaxCost(MEMORY_CACHE_SIZE);
+
+    // homePath() is made on its first call, that must not be on the pool
+    aseman_image_color_disk_cache()->setFileName(AsemanApplication::homePath() + DISK_CACHE_FILE);
+    p->order = 0;
+    p->pool = new QThreadPool(this);
+    p->pool->setMaxThreadCount( qMax(1, QThread::idealThreadCount()) );
 }
 
-const QHash<int, QHash<QString,QColor> > &AsemanImageColorAnalizorThread::results() const
+/*
+ * Finds a result in memory only, without touching the disk. The disk
+ * cache is checked by the job that analize() queues.
+ */
+bool AsemanImageColorAnalizorThread::lookup(int method, const QString &path, QList<QColor> &colors)
 {
-    return p->results;
+    QList<QColor> *cached = p->results.object( AsemanImageColorAnalizorKey(method, path) );
+    if( !cached )
+        return false;
+
+    colors = *cached;
+    return true;
 }
 
-void AsemanImageColorAnalizorThread::analize(int method, const QString &path)
+void AsemanImageColorAnalizorThread::analize(AsemanImageColorAnalizor *subscriber, int method, const QString &path)
 {
-    if( p->results.contains(method) && p->results.value(method).contains(path) )
+    const AsemanImageColorAnalizorKey key(method, path);
+    if( p->results.contains(key) )
         return;
 
-    AsemanImageColorAnalizorCore *core = getCore();
-    if( !core )
-    {
-        QPair<int,QString> pair(method, path);
-        p->queue.append(pair);
+    p->subscribers[key] << subscriber;
+    if( p->running.contains(key) )
         return;
-    }
 
-    QMetaObject::invokeMethod( core, "analize", Qt::QueuedConnection, Q_ARG(int,method) , Q_ARG(QString,path) );
+    // A repeated request moves the job to the front
+    if( p->queued.contains(key) )
+        p->queue.remove( p->queued.take(key) );
+
+    p->order++;
+    p->queue.insert(p->order, key);
+    p->queued.insert(key, p->order);
+
+    dispatch();
 }
 
-void AsemanImageColorAnalizorThread::found_slt(AsemanImageColorAnalizorCore *c, int method, const QString &source, const QColor & color)
+void AsemanImageColorAnalizorThread::release(AsemanImageColorAnalizor *subscriber, int method, const QString &path)
 {
-    p->results[method][source] = color;
-    Q_EMIT found(method, source);
-
-    p->free_cores.append(c);
-    if( p->queue.isEmpty() )
+    const AsemanImageColorAnalizorKey key(method, path);
+    QHash<AsemanImageColorAnalizorKey, QList<AsemanImageColorAnalizor*> >::iterator i = p->subscribers.find(key);
+    if( i == p->subscribers.end() )
         return;
 
-    AsemanImageColorAnalizorCore *core = getCore();
-    if( !core )
+    i.value().removeOne(subscriber);
+    if( !i.value().isEmpty() )
         return;
 
-    const QPair<int,QString> & pair = p->queue.takeFirst();
-    QMetaObject::invokeMethod( core, "analize", Qt::QueuedConnection, Q_ARG(int,pair.first), Q_ARG(QString,pair.second) );
+    p->subscribers.erase(i);
+    if( p->queued.contains(key) )
+        p->queue.remove( p->queued.take(key) );
 }
 
-AsemanImageColorAnalizorCore *AsemanImageColorAnalizorThread::getCore()
+void AsemanImageColorAnalizorThread::dispatch()
 {
-    if( !p->free_cores.isEmpty() )
-        return p->free_cores.takeFirst();
-    if( p->cores.count() > MAX_ACTIVE_THREADS )
-        return 0;
+    while( !p->queue.isEmpty() && p->running.count() < p->pool->maxThreadCount() )
+    {
+        QMap<quint64, AsemanImageColorAnalizorKey>::iterator last = p->queue.end();
+        last--;
+
+        const AsemanImageColorAnalizorKey key = last.value();
+        p->queue.erase(last);
+        p->queued.remove(key);
+        p->running.insert(key);
+
+        p->pool->start( new AsemanImageColorAnalizorCore(this, key.first, key.second) );
+    }
+}
 
-    QThread *thread = new QThread(this);
+void AsemanImageColorAnalizorThread::found_slt(int method, const QString &source, const QList<QColor> &colors)
+{
+    const AsemanImageColorAnalizorKey key(method, source);
+    p->running.remove(key);
 
-    AsemanImageColorAnalizorCore *core = new AsemanImageColorAnalizorCore();
-    core->moveToThread(thread);
+    p->results.insert(key, new QList<QColor>(colors));
 
-    connect( core, &AsemanImageColorAnalizorCore::found, this, &AsemanImageColorAnalizorThread::found_slt, Qt::QueuedConnection );
+    // Only the analizors waiting for this result are told. They are
+    // guarded, because a colorChanged() handler may delete the others.
+    QList< QPointer<AsemanImageColorAnalizor> > subscribers;
+    for(AsemanImageColorAnalizor *subscriber: p->subscribers.take(key))
+        subscribers << subscriber;
 
-    thread->start(QThread::LowestPriority);
-    p->cores.insert(core);
+    for(const QPointer<AsemanImageColorAnalizor> &subscriber: subscribers)
+        if( subscriber )
+            subscriber->found(method, source, colors);
 
-    return core;
+    dispatch();
 }
 
 AsemanImageColorAnalizorThread::~AsemanImageColorAnalizorThread()
 {
-    for(AsemanImageColorAnalizorCore *core: p->cores)
-    {
-        QThread *thread = core->thread();
-        thread->quit();
-        thread->wait();
-        core->deleteLater();
-    }
-
+    p->pool->clear();
+    p->pool->waitForDone();
     delete p;
 }
 
@@ -221,89 +477,74 @@ AsemanImageColorAnalizorThread::~AsemanImageColorAnalizorThread()
 class AsemanImageColorAnalizorCorePrivate
 {
 public:
+    AsemanImageColorAnalizorThread *thread;
+    int method;
+    QString path;
 };
 
-AsemanImageColorAnalizorCore::AsemanImageColorAnalizorCore(QObject *parent) :
-    QObject(parent)
+AsemanImageColorAnalizorCore::AsemanImageColorAnalizorCore(AsemanImageColorAnalizorThread *thread, int method, const QString &path)
 {
     p = new AsemanImageColorAnalizorCorePrivate;
+    p->thread = thread;
+    p->method = method;
+    p->path = path;
 }
 
-void AsemanImageColorAnalizorCore::analize(int method, const QString &pt)
+void AsemanImageColorAnalizorCore::run()
 {
-    QString path = pt;
-    if(path.left(AsemanDevices::localFilesPrePath().size()) == AsemanDevices::localFilesPrePath())
-        path = path.mid(AsemanDevices::localFilesPrePath().size());
+    QThread::currentThread()->setPriority(QThread::LowestPriority);
 
-    QImageReader image(path);
+    // Stat before decoding, so a file changed meanwhile is not cached as new
+    const AsemanImageColorAnalizorKey key(p->method, p->path);
+    const QFileInfo info( filePath(p->path) );
+    const qint64 size = info.exists()? info.size() : -1;
+    const qint64 modified = info.lastModified().toMSecsSinceEpoch();
 
-    QSize image_size = image.size();
-    qreal ratio = image_size.width()/(qreal)image_size.height();
-    image_size.setWidth( IMAGE_WIDTH );
-    image_size.setHeight( IMAGE_WIDTH/ratio );
+    AsemanImageColorAnalizorDiskCache *disk = aseman_image_color_disk_cache();
+    QList<QColor> colors;
+    if( size < 0 || !disk->find(key, size, modified, colors) )
+    {
+        colors = analize(p->method, p->path);
 
-    image.setScaledSize( image_size );
-    const QImage & img = image.read();
+        // An empty result may be a file that is still being written
+        if( size >= 0 && !colors.isEmpty() )
+            disk->insert(key, size, modified, colors);
+    }
 
-    QColor result;
+    QMetaObject::invokeMethod( p->thread, "found_slt", Qt::QueuedConnection, Q_ARG(int,p->method),
+                               Q_ARG(QString,p->path), Q_ARG(QList<QColor>,colors) );
+}
 
-    switch( method )
-    {
-    case AsemanImageColorAnalizor::Normal:
-    {
-        qreal sum_r = 0;
-        qreal sum_g = 0;
-        qreal sum_b = 0;
-        int count = 0;
+QString AsemanImageColorAnalizorCore::filePath(const QString &path)
+{
+    if(path.left(AsemanDevices::localFilesPrePath().size()) == AsemanDevices::localFilesPrePath())
+        return path.mid(AsemanDevices::localFilesPrePath().size());
 
-        for( int i=0 ; i<image_size.width(); i++ )
-        {
-            for( int j=0 ; j<image_size.height(); j++ )
-            {
-                QColor clr = img.pixel(i,j);
-                qreal mid = (clr.red()+clr.green()+clr.blue())/3;
-                if( mid > 180 || mid < 70 )
-                    continue;
-
-                sum_r += clr.red();
-                sum_g += clr.green();
-                sum_b += clr.blue();
-                count++;
-            }
-        }
+    return path;
+}
 
-        result = QColor( sum_r/count, sum_g/count, sum_b/count );
-    }
-        break;
+QList<QColor> AsemanImageColorAnalizorCore::analize(int method, const QString &path)
+{
+    const QString & file = filePath(path);
 
-    case AsemanImageColorAnalizor::MoreSaturation:
-    {
-        qreal sum_r = 0;
-        qreal sum_g = 0;
-        qreal sum_b = 0;
-        int count = 0;
+    QSize image_size = AsemanImageHeader::read(file).size();
+    qreal ratio = image_size.width()/(qreal)image_size.height();
+    image_size.setWidth( IMAGE_WIDTH );
+    image_size.setHeight( IMAGE_WIDTH/ratio );
 
-        for( int i=0 ; i<image_size.width(); i++ )
-        {
-            for( int j=0 ; j<image_size.height(); j++ )
-            {
-                QColor clr = img.pixel(i,j);
-                if( clr.saturation() < 150 || clr.lightness() < 50 )
-                    continue;
-
-                sum_r += clr.red();
-                sum_g += clr.green();
-                sum_b += clr.blue();
-                count++;
-            }
-        }
+    // A small read is enough for the colors. EXIF thumbnails are about
+    // 160 pixels wide, too small for IMAGE_WIDTH, so it is a scaled read.
+    const QImage & img = AsemanImageDecodeStrategy::decode(file, image_size, false);
 
-        result = QColor( sum_r/count, sum_g/count, sum_b/count );
-    }
-        break;
-    }
+    if( method == AsemanImageColorAnalizor::Palette )
+        return AsemanImageColorKernel::palette(img, PALETTE_SIZE);
+
+    QList<QColor> result;
+    const QColor & color = AsemanImageColorKernel::average(img, method);
+    if( color.isValid() )
+        result << color;
 
-    Q_EMIT found( this, method, path, result );
+    return result;
 }
 
 AsemanImageColorAnalizorCore::~AsemanImageColorAnalizorCore()
@@ -23,6 +23,8 @@
 #include <QColor>
 #include <QHash>
 #include <QUrl>
+#include <QVariantList>
+#include <QRunnable>
 
 #include "asemantools_global.h"
 
@@ -30,15 +32,18 @@ class AsemanImageColorAnalizorPrivate;
 class LIBASEMANTOOLSSHARED_EXPORT AsemanImageColorAnalizor : public QObject
 {
     Q_OBJECT
+    friend class AsemanImageColorAnalizorThread;
     Q_PROPERTY(QUrl source READ source WRITE setSource NOTIFY sourceChanged)
     Q_PROPERTY(QColor color READ color NOTIFY colorChanged)
+    Q_PROPERTY(QVariantList palette READ palette NOTIFY paletteChanged)
     Q_PROPERTY(int method READ method WRITE setMethod NOTIFY methodChanged)
     Q_ENUMS(Method)
 
 public:
     enum Method {
         Normal,
-        MoreSaturation
+        MoreSaturation,
+        Palette
     };
 
     AsemanImageColorAnalizor(QObject *parent = 0);
@@ -51,24 +56,42 @@ public:
     void setMethod( int m );
 
     QColor color() const;
+    QVariantList palette() const;
 
 Q_SIGNALS:
     void sourceChanged();
     void colorChanged();
+    void paletteChanged();
     void methodChanged();
 
 private Q_SLOTS:
-    void found(int method, const QString & path );
     void start();
 
 private:
     QString sourceString() const;
+    void found(int method, const QString & path, const QList<QColor> &colors);
+    void setColors(const QList<QColor> &colors);
+    void release();
 
 private:
     AsemanImageColorAnalizorPrivate *p;
 };
 
 
+/*
+ * Schedules the analysis jobs on a thread pool of its own.
+ *  - A (method, path) pair is only analized once, repeated requests
+ *    are merged with the queued or running job.
+ *  - Queued jobs run newest first, so the items just shown on the
+ *    screen come first.
+ *  - Every analize() subscribes an analizor to the result, until it is
+ *    delivered or release() is called. Queued jobs that nobody waits
+ *    for anymore are dropped.
+ * Results are kept in a bounded LRU in memory and in a cache file
+ * keyed by the file size and modification time, so a warm start finds
+ * them without decoding the images again. lookup() only answers from
+ * memory, the cache file is read and written by the jobs on the pool.
+ */
 class AsemanImageColorAnalizorThreadPrivate;
 class AsemanImageColorAnalizorThread : public QObject
 {
@@ -77,19 +100,16 @@ public:
     AsemanImageColorAnalizorThread(QObject *parent = 0);
     virtual ~AsemanImageColorAnalizorThread();
 
-    const QHash<int, QHash<QString, QColor> > &results() const;
-
-public Q_SLOTS:
-    void analize(int method, const QString & path );
+    bool lookup(int method, const QString & path, QList<QColor> &colors);
 
-Q_SIGNALS:
-    void found( int method, const QString & path );
+    void analize(AsemanImageColorAnalizor *subscriber, int method, const QString & path);
+    void release(AsemanImageColorAnalizor *subscriber, int method, const QString & path);
 
 private Q_SLOTS:
-    void found_slt(class AsemanImageColorAnalizorCore *core, int method, const QString & path , const QColor &color);
+    void found_slt(int method, const QString & path , const QList<QColor> &colors);
 
 private:
-    AsemanImageColorAnalizorCore *getCore();
+    void dispatch();
 
 private:
     AsemanImageColorAnalizorThreadPrivate *p;
@@ -97,18 +117,16 @@ private:
 
 
 class AsemanImageColorAnalizorCorePrivate;
-class AsemanImageColorAnalizorCore : public QObject
+class AsemanImageColorAnalizorCore : public QRunnable
 {
-    Q_OBJECT
 public:
-    AsemanImageColorAnalizorCore(QObject *parent = 0);
+    AsemanImageColorAnalizorCore(AsemanImageColorAnalizorThread *thread, int method, const QString & path);
     virtual ~AsemanImageColorAnalizorCore();
 
-public Q_SLOTS:
-    void analize( int method, const QString & path );
+    virtual void run();
 
-Q_SIGNALS:
-    void found(AsemanImageColorAnalizorCore *core, int method, const QString & path , const QColor &color);
+    static QList<QColor> analize( int method, const QString & path );
+    static QString filePath( const QString & path );
 
 private:
     AsemanImageColorAnalizorCorePrivate *p;
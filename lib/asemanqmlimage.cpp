@@ -1,8 +1,17 @@
 #include "asemanqmlimage.h"
 #include "asemantools.h"
+#include "private/asemanimagedecoder.h"
+#include "private/asemanimageheader.h"
+#include "private/asemanimagecache.h"
 
-#include <QPainter>
+#include <QPointer>
 #include <QMutex>
+#include <QMutexLocker>
+#include <QHash>
+#include <QQuickWindow>
+#include <QSGGeometryNode>
+#include <QSGTextureMaterial>
+#include <QSGTexture>
 #include <QImageReader>
 #include <QImage>
 #include <QFileInfo>
@@ -20,15 +29,153 @@ public:
     int verticalAlignment;
     bool mirror;
     bool smooth;
+    bool mipmap;
     qreal progress;
     QMutex mutex;
 
     QString cacheHash;
     QImage cacheImage;
+    QUrl cacheSource;
+
+    QString decodeHash;
+    QPointer<AsemanImageDecoder> decoder;
+
+    // header of the source, read once until the source changes or refresh()
+    AsemanImageHeader header;
+    bool headerLoaded;
+    QMutex headerMutex;
 };
 
+/*
+ * Textures of the decoded images, one per window and image. Items that
+ * show the same image from AsemanImageCache share its QImage, so they
+ * also share one texture upload. Used on the render threads only.
+ */
+class AsemanQmlImageTextureCache
+{
+public:
+    typedef QPair<QQuickWindow*, QPair<qint64,bool> > Key;
+
+    QSGTexture *acquire(QQuickWindow *window, const QImage &image, bool mipmap) {
+        QMutexLocker locker(&mutex);
+        const Key key(window, QPair<qint64,bool>(image.cacheKey(), mipmap));
+        QPair<QSGTexture*, int> &entry = textures[key];
+        if(!entry.first)
+        {
+            QQuickWindow::CreateTextureOptions options = 0;
+            if(mipmap)
+                options |= QQuickWindow::TextureHasMipmaps;
+            entry.first = window->createTextureFromImage(image, options);
+        }
+
+        entry.second++;
+        return entry.first;
+    }
+
+    void release(QQuickWindow *window, qint64 imageKey, bool mipmap) {
+        QMutexLocker locker(&mutex);
+        const Key key(window, QPair<qint64,bool>(imageKey, mipmap));
+        QHash<Key, QPair<QSGTexture*, int> >::iterator i = textures.find(key);
+        if(i == textures.end())
+            return;
+
+        i.value().second--;
+        if(i.value().second > 0)
+            return;
+
+        delete i.value().first;
+        textures.erase(i);
+    }
+
+private:
+    QMutex mutex;
+    QHash<Key, QPair<QSGTexture*, int> > textures;
+};
+
+static AsemanQmlImageTextureCache *aseman_qml_image_textures()
+{
+    static AsemanQmlImageTextureCache *cache = new AsemanQmlImageTextureCache;
+    return cache;
+}
+
+class AsemanQmlImageNode : public QSGGeometryNode
+{
+public:
+    AsemanQmlImageNode() :
+        geometry(QSGGeometry::defaultAttributes_TexturedPoint2D(), 4),
+        texture(0),
+        window(0),
+        imageKey(0),
+        mipmap(false) {
+        setGeometry(&geometry);
+        setMaterial(&material);
+    }
+
+    virtual ~AsemanQmlImageNode() {
+        setImage(0, QImage(), false);
+    }
+
+    void setImage(QQuickWindow *win, const QImage &image, bool mip) {
+        if(texture && win == window && image.cacheKey() == imageKey && mip == mipmap)
+            return;
+
+        if(texture)
+            aseman_qml_image_textures()->release(window, imageKey, mipmap);
+
+        texture = 0;
+        window = win;
+        imageKey = image.cacheKey();
+        mipmap = mip;
+        if(window && !image.isNull())
+            texture = aseman_qml_image_textures()->acquire(window, image, mipmap);
+
+        material.setTexture(texture);
+        opaqueMaterial.setTexture(texture);
+        setOpaqueMaterial(texture && !texture->hasAlphaChannel()? &opaqueMaterial : 0);
+        markDirty(QSGNode::DirtyMaterial);
+    }
+
+    void setFiltering(bool smooth, bool tile) {
+        const QSGTexture::Filtering filtering = smooth? QSGTexture::Linear : QSGTexture::Nearest;
+        const QSGTexture::WrapMode wrap = tile? QSGTexture::Repeat : QSGTexture::ClampToEdge;
+        const QSGTexture::Filtering mipmapFiltering = mipmap? filtering : QSGTexture::None;
+
+        QSGOpaqueTextureMaterial *materials[] = { &material, &opaqueMaterial };
+        for(QSGOpaqueTextureMaterial *m: materials)
+        {
+            m->setFiltering(filtering);
+            m->setMipmapFiltering(mipmapFiltering);
+            m->setHorizontalWrapMode(wrap);
+            m->setVerticalWrapMode(wrap);
+        }
+        markDirty(QSGNode::DirtyMaterial);
+    }
+
+    QSGGeometry geometry;
+    QSGTextureMaterial material;
+    QSGOpaqueTextureMaterial opaqueMaterial;
+    QSGTexture *texture;
+    QQuickWindow *window;
+    qint64 imageKey;
+    bool mipmap;
+};
+
+/*
+ * Position of a length inside the space, by the alignment flags.
+ * No flag means centered.
+ */
+static qreal aseman_qml_image_align(qreal space, qreal length, int alignment, int before, int after)
+{
+    if(alignment & before)
+        return 0;
+    if(alignment & after)
+        return space - length;
+
+    return (space - length)/2;
+}
+
 AsemanQmlImage::AsemanQmlImage(QQuickItem *parent) :
-    QQuickPaintedItem(parent)
+    QQuickItem(parent)
 {
     p = new Private;
     p->fillMode = PreserveAspectFit;
@@ -40,35 +187,107 @@ AsemanQmlImage::AsemanQmlImage(QQuickItem *parent) :
     p->mirror = false;
     p->progress = 0;
     p->smooth = false;
-//    setRenderTarget(FramebufferObject);
+    p->mipmap = false;
+    p->headerLoaded = false;
+    setFlag(ItemHasContents, true);
+
+    AsemanImageCache::watchApplicationState();
 }
 
-void AsemanQmlImage::paint(QPainter *painter)
+/*
+ * The decoded image is uploaded once as a texture, and the fill modes,
+ * tiling, alignment and mirroring are all done by the node geometry.
+ */
+QSGNode *AsemanQmlImage::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data)
 {
+    Q_UNUSED(data)
+    AsemanQmlImageNode *node = static_cast<AsemanQmlImageNode*>(oldNode);
+
+    // Nothing is decoded before the item has a size, a 0x0 painted
+    // size would mean a full resolution decode.
+    const QRectF bounds = boundingRect();
+    if(bounds.isEmpty() || !window())
+    {
+        delete node;
+        return 0;
+    }
+
     p->mutex.lock();
     QUrl source = p->source;
     QSizeF paintSize = paintedSize();
     p->mutex.unlock();
 
+    // Asynchronous images keep showing the last decoded frame until
+    // the decoder started by refresh() delivers the new one.
     QString cacheHash = hash();
-    if(cacheHash != p->cacheHash)
+    if(cacheHash != p->cacheHash && !p->asynchronous)
     {
         QString path = AsemanTools::urlToLocalPath(source);
-        if(!QFileInfo::exists(path))
-            return;
+        const bool exists = QFileInfo::exists(path);
+        if(!exists || !paintSize.toSize().isEmpty())
+        {
+            p->mutex.lock();
+            p->cacheImage = exists? AsemanImageDecoder::load(path, paintSize.toSize(), p->autoTransform, p->cache) : QImage();
+            p->cacheHash = cacheHash;
+            p->cacheSource = source;
+            p->mutex.unlock();
+        }
+    }
 
-        QImageReader reader(path);
-        reader.setScaledSize(paintSize.toSize());
+    p->mutex.lock();
+    const QImage image = p->cacheImage;
+    p->mutex.unlock();
 
-        p->cacheImage = reader.read();
-        p->cacheHash = cacheHash;
+    if(image.isNull())
+    {
+        delete node;
+        return 0;
     }
 
-    qreal x = width()/2 - p->cacheImage.width()/2;
-    qreal y = height()/2 - p->cacheImage.height()/2;
+    if(!node)
+        node = new AsemanQmlImageNode;
+
+    const bool tile = (p->fillMode == Tile);
+    node->setImage(window(), image, p->mipmap);
+    node->setFiltering(p->smooth, tile);
 
+    // the target rectangle in the item, and the part of the image on it
+    // with (0,0,1,1) meaning the whole image
+    QRectF target;
+    QRectF src;
+    const QSizeF size = (p->fillMode == Stretch)? bounds.size() : paintedSize();
+    if(size.isEmpty())
+    {
+        delete node;
+        return 0;
+    }
 
-    painter->drawImage(x, y, p->cacheImage);
+    const qreal x = aseman_qml_image_align(bounds.width(), size.width(), p->horizontalAlignment, Qt::AlignLeft, Qt::AlignRight);
+    const qreal y = aseman_qml_image_align(bounds.height(), size.height(), p->verticalAlignment, Qt::AlignTop, Qt::AlignBottom);
+    if(tile)
+    {
+        // tiles are laid out from the aligned position of the first one
+        target = bounds;
+        src = QRectF(-x/size.width(), -y/size.height(), bounds.width()/size.width(), bounds.height()/size.height());
+    }
+    else
+    {
+        const QRectF painted(x, y, size.width(), size.height());
+        target = painted.intersected(bounds);
+        src = QRectF((target.x() - painted.x())/painted.width(), (target.y() - painted.y())/painted.height(),
+                     target.width()/painted.width(), target.height()/painted.height());
+
+        const QRectF sub = node->texture->normalizedTextureSubRect();
+        src = QRectF(sub.x() + src.x()*sub.width(), sub.y() + src.y()*sub.height(),
+                     src.width()*sub.width(), src.height()*sub.height());
+    }
+
+    if(p->mirror)
+        src = QRectF(src.right(), src.y(), -src.width(), src.height());
+
+    QSGGeometry::updateTexturedRectGeometry(&node->geometry, target, src);
+    node->markDirty(QSGNode::DirtyGeometry);
+    return node;
 }
 
 void AsemanQmlImage::setSource(const QUrl &source)
@@ -82,6 +301,7 @@ void AsemanQmlImage::setSource(const QUrl &source)
 
     refresh();
     Q_EMIT sourceChanged();
+    Q_EMIT sourceSizeChanged();
 }
 
 QUrl AsemanQmlImage::source() const
@@ -98,7 +318,10 @@ void AsemanQmlImage::setFillMode(int fillMode)
     p->fillMode = fillMode;
     p->mutex.unlock();
 
-    refresh();
+    if(p->asynchronous)
+        startDecode();
+
+    update();
     Q_EMIT fillModeChanged();
 }
 
@@ -116,7 +339,10 @@ void AsemanQmlImage::setAsynchronous(bool asynchronous)
     p->asynchronous = asynchronous;
     p->mutex.unlock();
 
-    refresh();
+    if(p->asynchronous)
+        startDecode();
+
+    update();
     Q_EMIT asynchronousChanged();
 }
 
@@ -170,7 +396,7 @@ void AsemanQmlImage::setHorizontalAlignment(int horizontalAlignment)
     p->horizontalAlignment = horizontalAlignment;
     p->mutex.unlock();
 
-    refresh();
+    update();
     Q_EMIT horizontalAlignmentChanged();
 }
 
@@ -188,7 +414,7 @@ void AsemanQmlImage::setVerticalAlignment(int verticalAlignment)
     p->verticalAlignment = verticalAlignment;
     p->mutex.unlock();
 
-    refresh();
+    update();
     Q_EMIT verticalAlignmentChanged();
 }
 
@@ -199,21 +425,20 @@ int AsemanQmlImage::verticalAlignment() const
 
 void AsemanQmlImage::setMipmap(bool mipmap)
 {
-    if(QQuickPaintedItem::mipmap() == mipmap)
+    if(p->mipmap == mipmap)
         return;
 
-
     p->mutex.lock();
-    QQuickPaintedItem::setMipmap(mipmap);
+    p->mipmap = mipmap;
     p->mutex.unlock();
 
-    refresh();
+    update();
     Q_EMIT mipmapChanged();
 }
 
 bool AsemanQmlImage::mipmap() const
 {
-    return QQuickPaintedItem::mipmap();
+    return p->mipmap;
 }
 
 void AsemanQmlImage::setMirror(bool mirror)
@@ -225,7 +450,7 @@ void AsemanQmlImage::setMirror(bool mirror)
     p->mirror = mirror;
     p->mutex.unlock();
 
-    refresh();
+    update();
     Q_EMIT mirrorChanged();
 }
 
@@ -243,7 +468,7 @@ void AsemanQmlImage::setSmooth(bool smooth)
     p->smooth = smooth;
     p->mutex.unlock();
 
-    refresh();
+    update();
     Q_EMIT smoothChanged();
 }
 
@@ -264,9 +489,14 @@ qreal AsemanQmlImage::paintedWidth() const
 
 QSize AsemanQmlImage::imageSize() const
 {
-    QString path = AsemanTools::urlToLocalPath(p->source);
-    QImageReader reader(path);
-    return reader.size();
+    QMutexLocker locker(&p->headerMutex);
+    if(!p->headerLoaded)
+    {
+        p->header = AsemanImageHeader::read(AsemanTools::urlToLocalPath(p->source));
+        p->headerLoaded = true;
+    }
+
+    return p->autoTransform? p->header.transformedSize() : p->header.size();
 }
 
 QSizeF AsemanQmlImage::paintedSize() const
@@ -333,22 +563,131 @@ qreal AsemanQmlImage::progress() const
 
 void AsemanQmlImage::refresh()
 {
+    p->headerMutex.lock();
+    p->headerLoaded = false;
+    p->headerMutex.unlock();
+
+    if(p->asynchronous)
+        startDecode();
+
+    update();
+}
+
+void AsemanQmlImage::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChanged(newGeometry, oldGeometry);
+    if(newGeometry.size() == oldGeometry.size())
+        return;
+
+    if(p->asynchronous)
+        startDecode();
+
     update();
 }
 
+void AsemanQmlImage::startDecode()
+{
+    const QString cacheHash = hash();
+    if(cacheHash == p->cacheHash || cacheHash == p->decodeHash)
+        return;
+
+    if(p->decoder)
+        p->decoder->cancel();
+
+    p->decodeHash.clear();
+    p->decoder = 0;
+
+    const QString path = AsemanTools::urlToLocalPath(p->source);
+    if(!QFileInfo::exists(path))
+    {
+        p->mutex.lock();
+        p->cacheImage = QImage();
+        p->cacheHash = cacheHash;
+        p->cacheSource = p->source;
+        p->mutex.unlock();
+        return;
+    }
+
+    // Waits for geometryChanged(), see updatePaintNode()
+    const QSize size = paintedSize().toSize();
+    if(size.isEmpty())
+        return;
+
+    if(p->cache)
+    {
+        // Shown right away when another item already decoded it
+        const QImage &image = AsemanImageDecoder::cached(path, size, p->autoTransform);
+        if(!image.isNull())
+        {
+            p->mutex.lock();
+            p->cacheImage = image;
+            p->cacheHash = cacheHash;
+            p->cacheSource = p->source;
+            p->mutex.unlock();
+            setProgress(1);
+            return;
+        }
+    }
+
+    AsemanImageDecoder *decoder = new AsemanImageDecoder(path, size, p->autoTransform, p->cache);
+    connect(decoder, &AsemanImageDecoder::progress, this, [this, decoder](qreal progress){
+        if(p->decoder == decoder)
+            setProgress(progress);
+    });
+    connect(decoder, &AsemanImageDecoder::preview, this, [this, decoder](const QImage &image){
+        // A preview never replaces a sharper image of the same source
+        if(p->decoder != decoder)
+            return;
+        if(p->cacheSource == p->source && p->cacheImage.width() >= image.width())
+            return;
+
+        p->mutex.lock();
+        p->cacheImage = image;
+        p->cacheSource = p->source;
+        p->mutex.unlock();
+        update();
+    });
+    connect(decoder, &AsemanImageDecoder::finished, this, [this, cacheHash](const QImage &image){
+        if(cacheHash != p->decodeHash)
+            return;
+
+        p->mutex.lock();
+        p->cacheImage = image;
+        p->cacheHash = cacheHash;
+        p->cacheSource = p->source;
+        p->mutex.unlock();
+
+        p->decodeHash.clear();
+        p->decoder = 0;
+        update();
+    });
+
+    p->decodeHash = cacheHash;
+    p->decoder = decoder;
+    decoder->start();
+}
+
+void AsemanQmlImage::setProgress(qreal progress)
+{
+    if(p->progress == progress)
+        return;
+
+    p->progress = progress;
+    Q_EMIT progressChanged();
+}
+
+/*
+ * Only the inputs of the decode are hashed. Alignment, mirroring and
+ * filtering are done by the node, so changing them keeps the image.
+ */
 QString AsemanQmlImage::hash()
 {
     QByteArray data;
     QDataStream stream(&data, QIODevice::WriteOnly);
-    stream << p->asynchronous;
     stream << p->autoTransform;
     stream << p->cache;
-    stream << p->fillMode;
-    stream << p->horizontalAlignment;
-    stream << p->mirror;
-    stream << p->smooth;
     stream << p->source;
-    stream << p->verticalAlignment;
+    stream << paintedSize().toSize();
 
     return QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
 }
@@ -1,13 +1,13 @@
 #ifndef ASEMANQMLIMAGE_H
 #define ASEMANQMLIMAGE_H
 
-#include <QQuickPaintedItem>
+#include <QQuickItem>
 #include <QUrl>
 #include <QVariant>
 
 #include "asemantools_global.h"
 
-class LIBASEMANTOOLSSHARED_EXPORT AsemanQmlImage : public QQuickPaintedItem
+class LIBASEMANTOOLSSHARED_EXPORT AsemanQmlImage : public QQuickItem
 {
     Q_OBJECT
     Q_ENUMS(FillMode)
@@ -40,8 +40,6 @@ public:
     AsemanQmlImage(QQuickItem *parent = Q_NULLPTR);
     virtual ~AsemanQmlImage();
 
-    virtual void paint(QPainter *painter);
-
     void setSource(const QUrl &source);
     QUrl source() const;
 
@@ -100,6 +98,12 @@ public Q_SLOTS:
 
 protected:
     QString hash();
+    virtual void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry);
+    virtual QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data);
+
+private:
+    void startDecode();
+    void setProgress(qreal progress);
 
 private:
     Private *p;
@@ -45,11 +45,36 @@
 #include <QtEndian>
 #include <QDate>
 #include <QTime>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QCache>
+#include <QFile>
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 10, 0))
+#include <QRandomGenerator>
+#endif
 
 #include <QDebug>
 
+#if defined(__SSE2__) && (Q_BYTE_ORDER == Q_LITTLE_ENDIAN)
+#define WITH_SERPENT_SSE2
+#include <emmintrin.h>
+// AVX2 is compiled for a single function each and selected at runtime
+#if defined(Q_CC_GNU) && (defined(__x86_64__) || defined(__i386__))
+#define WITH_SERPENT_AVX2
+#include <immintrin.h>
+#endif
+#endif
 
 #define ROUNDS 32
+#define DEFAULT_PARALLEL_THRESHOLD 1048576
+#define PARALLEL_SEGMENT_SIZE 65536
+#define DEFAULT_SCHEDULE_CACHE_SIZE 16
+#define CTR_BATCH_BLOCKS 32
+#define IN_PLACE_RUN_SIZE 1024
 #define KEYSIZE_RC5 20
 #define KEYSIZE_SERPENT 32
 #define SSIZE_RC5 66
@@ -75,6 +100,7 @@ QByteArray header_SERPENT_32  = QString("SERPENT/32:").toLatin1();
 
 QByteArray header_CBC  = QString("CBC:PADN::").toLatin1();
 QByteArray header_CFB  = QString("CFB::").toLatin1();
+QByteArray header_CTR  = QString("CTR::").toLatin1();
 
 
 #ifdef WITH_SERPENT_FAST_SBOX
@@ -84,6 +110,27 @@ void serpent_sbox_it(int sbox, quint32 &X1, quint32 &X2,
                                quint32 &X3, quint32 &X4);
 #endif
 
+inline void xor_bytes(uchar *dst, const uchar *src, int len) {
+    for ( int i = 0 ; i < len ; i++ ) {
+        dst[i] ^= src[i];
+    }
+}
+
+static int block_size(Algorithm a) {
+    switch (a) {
+#ifdef WITHRC5
+    case RC5_32_32_20:
+        return 8;
+    case RC5_64_32_20:
+        return 16;
+#endif
+    case SERPENT_32:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
 #ifdef WITHRC5
 Algorithm Info::fastRC5() {
     #if (QT_POINTER_SIZE==4)
@@ -120,6 +167,82 @@ QString Info::errorText(Error e) {
     return QString();
 }
 
+QByteArray Info::header(Algorithm a, Mode m) {
+    QByteArray result;
+    switch (a) {
+#ifdef WITHRC5
+    case RC5_32_32_20:
+        result.append(header_RC5_32_32_20);
+        break;
+    case RC5_64_32_20:
+        result.append(header_RC5_64_32_20);
+        break;
+#endif
+    case SERPENT_32:
+        result.append(header_SERPENT_32);
+        break;
+    default:
+        return QByteArray();
+    }
+
+    switch (m) {
+    case ModeCBC:
+        result.append(header_CBC);
+        break;
+    case ModeCFB:
+        result.append(header_CFB);
+        break;
+    case ModeCTR:
+        result.append(header_CTR);
+        break;
+    default:
+        return QByteArray();
+    }
+    return result;
+}
+
+
+/* *** KEY SCHEDULE CACHE *** */
+
+/*
+ * An expanded key, shared between all Key objects using the same key.
+ * The memory is wiped before it is freed.
+ */
+class KeySchedule {
+public:
+    KeySchedule(int words) {
+        size = words;
+        data = new quint64[words];
+    }
+    ~KeySchedule() {
+        volatile quint64 *d = data;
+        for ( int i = 0 ; i < size ; i++ ) {
+            d[i] = 0;
+        }
+        delete[] data;
+    }
+
+    quint64 *data;
+    int size;
+};
+
+class KeyScheduleCacheEntry {
+public:
+    QSharedPointer<KeySchedule> schedule;
+};
+
+class KeyScheduleCache {
+public:
+    KeyScheduleCache() : cache(DEFAULT_SCHEDULE_CACHE_SIZE) {}
+    QMutex mutex;
+    QCache<QByteArray, KeyScheduleCacheEntry> cache;
+};
+
+static KeyScheduleCache *key_schedule_cache() {
+    static KeyScheduleCache *instance = new KeyScheduleCache;
+    return instance;
+}
+
 
 Key::Key() {
 #ifdef WITHRC5
@@ -131,6 +254,7 @@ Key::Key() {
 
 Key::Key(const QByteArray &k) {
     key = k;
+    digest = QCryptographicHash::hash(key, QCryptographicHash::Sha1);
 #ifdef WITHRC5
     s32 = 0;
     s64 = 0;
@@ -142,6 +266,7 @@ Key::Key(const QString &k) {
     QCryptographicHash qch(QCryptographicHash::Sha1);
     qch.addData(k.toUtf8());
     key = qch.result();
+    digest = QCryptographicHash::hash(key, QCryptographicHash::Sha1);
 #ifdef WITHRC5
     s32 = 0;
     s64 = 0;
@@ -150,11 +275,60 @@ Key::Key(const QString &k) {
 }
 
 Key::~Key() {
-#ifdef WITHRC5
-    delete[] s32;
-    delete[] s64;
-#endif
-    delete[] serpent;
+}
+
+void Key::setScheduleCacheSize(int keys) {
+    KeyScheduleCache *c = key_schedule_cache();
+    QMutexLocker locker(&c->mutex);
+    c->cache.setMaxCost(qMax(keys, 0));
+}
+
+int Key::scheduleCacheSize() {
+    KeyScheduleCache *c = key_schedule_cache();
+    QMutexLocker locker(&c->mutex);
+    return c->cache.maxCost();
+}
+
+void Key::clearScheduleCache() {
+    KeyScheduleCache *c = key_schedule_cache();
+    QMutexLocker locker(&c->mutex);
+    c->cache.clear();
+}
+
+/*
+ * The cache is keyed by the algorithm and a digest of the key, so the
+ * raw key never ends up in the cache index. The digest is taken in the
+ * constructors, only a default constructed Key hashes it here, with the
+ * mutex held by the expandKey caller.
+ */
+QByteArray Key::scheduleId(Algorithm a) {
+    if (digest.isEmpty()) {
+        digest = QCryptographicHash::hash(key, QCryptographicHash::Sha1);
+    }
+    QByteArray id;
+    id.reserve(digest.size() + 1);
+    id.append((char)a);
+    id.append(digest);
+    return id;
+}
+
+QSharedPointer<KeySchedule> Key::findSchedule(Algorithm a) {
+    const QByteArray id = scheduleId(a);
+    KeyScheduleCache *c = key_schedule_cache();
+    QMutexLocker locker(&c->mutex);
+    KeyScheduleCacheEntry *entry = c->cache.object(id);
+    if (!entry) return QSharedPointer<KeySchedule>();
+    return entry->schedule;
+}
+
+void Key::insertSchedule(Algorithm a, QSharedPointer<KeySchedule> schedule) {
+    const QByteArray id = scheduleId(a);
+    KeyScheduleCache *c = key_schedule_cache();
+    QMutexLocker locker(&c->mutex);
+    if (c->cache.maxCost() == 0) return;
+    KeyScheduleCacheEntry *entry = new KeyScheduleCacheEntry;
+    entry->schedule = schedule;
+    c->cache.insert(id, entry);
 }
 
 
@@ -170,12 +344,18 @@ QByteArray Key::resizeKey(int ks) {
 
 #ifdef WITHRC5
 void Key::expandKeyRc532() {
+    QMutexLocker locker(&mutex);
     if (s32) return;
+    scheduleRc532 = findSchedule(RC5_32_32_20);
+    if (scheduleRc532) {
+        s32 = (quint32 *)scheduleRc532->data;
+        return;
+    }
     if ( KEYSIZE_RC5 != keyRc5.size() ) {
         keyRc5 = resizeKey(KEYSIZE_RC5);
     } 
-    s32 = new quint32[SSIZE_RC5];
-    quint32 *s = s32;
+    QSharedPointer<KeySchedule> schedule(new KeySchedule((SSIZE_RC5+1)/2));
+    quint32 *s = (quint32 *)schedule->data;
 
     unsigned char *k = (unsigned char *)(keyRc5.data());
     quint32 L[5];
@@ -199,17 +379,27 @@ void Key::expandKeyRc532() {
         i = (i + 1) % SSIZE_RC5;
         j = (j + 1) % 5;
     }
+
+    insertSchedule(RC5_32_32_20, schedule);
+    scheduleRc532 = schedule;
+    s32 = s;
 }
 #endif
 
 #ifdef WITHRC5
 void Key::expandKeyRc564() {
+    QMutexLocker locker(&mutex);
     if (s64) return;
+    scheduleRc564 = findSchedule(RC5_64_32_20);
+    if (scheduleRc564) {
+        s64 = scheduleRc564->data;
+        return;
+    }
     if ( KEYSIZE_RC5 != keyRc5.size() ) {
         keyRc5 = resizeKey(KEYSIZE_RC5);
     } 
-    s64 = new quint64[SSIZE_RC5];
-    quint64 *s = s64;
+    QSharedPointer<KeySchedule> schedule(new KeySchedule(SSIZE_RC5));
+    quint64 *s = schedule->data;
 
     unsigned char *k = (unsigned char *)(keyRc5.data());
     quint64 L[3];
@@ -231,6 +421,10 @@ void Key::expandKeyRc564() {
         i = (i + 1) % SSIZE_RC5;
         j = (j + 1) % 3;
     }
+
+    insertSchedule(RC5_64_32_20, schedule);
+    scheduleRc564 = schedule;
+    s64 = s;
 }
 #endif
 
@@ -239,11 +433,19 @@ void Key::expandKeySerpent() {
     quint32 i;
     quint32 tmp;
     quint32 *s;
+    quint32 *w;
+    QMutexLocker locker(&mutex);
     if (serpent) return;
+    scheduleSerpent = findSchedule(SERPENT_32);
+    if (scheduleSerpent) {
+        serpent = (quint32 *)scheduleSerpent->data;
+        return;
+    }
     if ( KEYSIZE_SERPENT != keySerpent.size() ) {
         keySerpent = resizeKey(KEYSIZE_SERPENT);
     } 
-    serpent = new quint32[SSIZE_SERPENT];
+    QSharedPointer<KeySchedule> schedule(new KeySchedule(SSIZE_SERPENT/2));
+    w = (quint32 *)schedule->data;
     s = new quint32[SSIZE_SERPENT + 8];
 
     unsigned char *k = (unsigned char *)(keySerpent.data());
@@ -253,21 +455,28 @@ void Key::expandKeySerpent() {
 
     for(i=8 ; i < SSIZE_SERPENT + 8 ; i++) {
         tmp = ( s[i-8] ^ s[i-5] ^ s[i-3] ^ s[i-1] ^ Q32 ^ (i-8) );
-        serpent[i-8] = s[i] = ROTL32(tmp, 11);
+        w[i-8] = s[i] = ROTL32(tmp, 11);
     }
     for(i=0;i<33;i++) {
 #ifdef WITH_SERPENT_FAST_SBOX
         tmp = (35-i) % 8;
         for (int j=0;j<4;j++) {
-            serpent[4*i+j] = serpent_sbox_fast(tmp,serpent[4*i+j]);
+            w[4*i+j] = serpent_sbox_fast(tmp,w[4*i+j]);
         }
 #else
-        serpent_sbox_it( (35-i)%8 , serpent[4*i  ], serpent[4*i+1],
-                                    serpent[4*i+2], serpent[4*i+3] );
+        serpent_sbox_it( (35-i)%8 , w[4*i  ], w[4*i+1],
+                                    w[4*i+2], w[4*i+3] );
 #endif
     }
 
+    for ( i=0 ; i < SSIZE_SERPENT + 8 ; i++ ) {
+        ((volatile quint32 *)s)[i] = 0;
+    }
     delete[] s;
+
+    insertSchedule(SERPENT_32, schedule);
+    scheduleSerpent = schedule;
+    serpent = w;
 }
 
 
@@ -326,6 +535,18 @@ Error Encryptor::encrypt(const QByteArray &plain, QByteArray &cipher, bool end)
             tmpIn.append(header_CFB);
             if ( 0 == modex) modex = new CFB(key, algorithm);
             break;
+        case ModeCTR:
+            if ( 0 == CTR::blockSize(algorithm) ) {
+                state = StateError;
+                return ErrorAlgorithmNotImplemented;
+            }
+            if ( InitializationVector::getNonce8().isEmpty() ) {
+                state = StateError;
+                return ErrorModeNotImplemented;
+            }
+            tmpIn.append(header_CTR);
+            if ( 0 == modex) modex = new CTR(key, algorithm);
+            break;
         case NoMode:
         case DetectMode:
         default:
@@ -341,8 +562,19 @@ Error Encryptor::encrypt(const QByteArray &plain, QByteArray &cipher, bool end)
 
         state = StateOn;
     case StateOn:
-        tmpIn.append(plain);
-        cipher = modex->encrypt(tmpIn, end);
+        {
+            // header and plain are encrypted one after the other
+            // straight into cipher, so plain is never copied
+            QByteArray tmpOut(modex->encryptSize(tmpIn.size() + plain.size()), Qt::Uninitialized);
+            uchar *out = (uchar *)tmpOut.data();
+            int size = 0;
+            if ( ! tmpIn.isEmpty() ) {
+                size = modex->encrypt((const uchar *)tmpIn.constData(), tmpIn.size(), out, false);
+            }
+            size += modex->encrypt((const uchar *)plain.constData(), plain.size(), out + size, end);
+            tmpOut.resize(size);
+            cipher = tmpOut;
+        }
         break;
     case StateError:
     default:
@@ -364,6 +596,7 @@ Decryptor::Decryptor(QSharedPointer<Key> k, Algorithm a, Mode m) {
     mode = m;
     state = StateReset;
     checksum = NoChecksum;
+    parallelThreshold = DEFAULT_PARALLEL_THRESHOLD;
     modex = 0;
 }
 
@@ -375,10 +608,17 @@ Checksum Decryptor::getChecksumType() {
     return checksum;
 }
 
+void Decryptor::setParallelThreshold(int bytes) {
+    parallelThreshold = bytes;
+    if ( modex ) modex->setParallelThreshold(bytes);
+}
+
+int Decryptor::getParallelThreshold() const {
+    return parallelThreshold;
+}
+
 Error Decryptor::decrypt(const QByteArray &cipher, QByteArray &plain, bool end) {
     QByteArray expectHeader;
-    QByteArray remainingFromHeader;
-    QByteArray tmpIn;
     QByteArray tmpOut;
     int neededForHeader = -1;
     int neededForIv = -1;
@@ -420,12 +660,22 @@ Error Decryptor::decrypt(const QByteArray &cipher, QByteArray &plain, bool end)
             neededForHeader = neededForIv + expectHeader.size();
             if ( 0 == modex) modex = new CFB(key, algorithm);
             break;
+        case ModeCTR:
+            if ( 0 == CTR::blockSize(algorithm) ) {
+                state = StateError;
+                return ErrorAlgorithmNotImplemented;
+            }
+            expectHeader.append(header_CTR);
+            neededForHeader = neededForIv + expectHeader.size();
+            if ( 0 == modex) modex = new CTR(key, algorithm);
+            break;
         case NoMode:
         case DetectMode:
         default:
             state = StateError;
             return ErrorNoMode;
         }
+        modex->setParallelThreshold(parallelThreshold);
 
 
         if ( cipher.size() < neededForHeader ) {
@@ -433,32 +683,42 @@ Error Decryptor::decrypt(const QByteArray &cipher, QByteArray &plain, bool end)
             return ErrorNotEnoughData;
         }
 
-        tmpOut = modex->decrypt(cipher.left(neededForHeader), false);
-
-        if ( tmpOut.startsWith(expectHeader) ) {
-            remainingFromHeader = tmpOut.right(tmpOut.size() - expectHeader.size());
-            tmpOut.clear();
-            tmpIn = cipher.right(cipher.size() - neededForHeader);
+        // Only the header is decrypted before checking the key. When more
+        // data follows, one extra byte is passed along so CBC does not hold
+        // the last header block hostage as possible padding.
+        {
+            const bool more = ( cipher.size() > neededForHeader );
+            const int headlen = more ? neededForHeader + 1 : cipher.size();
+            const uchar *in = (const uchar *)cipher.constData();
+            QByteArray head(modex->decryptSize(headlen), Qt::Uninitialized);
+            head.resize( modex->decrypt(in, headlen, (uchar *)head.data(), more ? false : end) );
+
+            if ( ! head.startsWith(expectHeader) ) {
+                modex->reset();
+                state = StateError;
+                return ErrorInvalidKey;
+            }
             state = StateOn;
-        } else {
-            state = StateError;
-            tmpOut.clear();
-            return ErrorInvalidKey;
+
+            // the rest goes straight behind what followed the header
+            const int headrest = head.size() - expectHeader.size();
+            tmpOut = QByteArray(headrest + modex->decryptSize(cipher.size() - headlen), Qt::Uninitialized);
+            memcpy(tmpOut.data(), head.constData() + expectHeader.size(), headrest);
+            int size = headrest;
+            if ( more ) {
+                size += modex->decrypt(in + headlen, cipher.size() - headlen, (uchar *)tmpOut.data() + headrest, end);
+            }
+            tmpOut.resize(size);
         }
+        break;
 
     case StateOn:
-        if ( tmpIn.isEmpty() ) {
-            tmpIn = cipher;
-        }
-        tmpOut = modex->decrypt(tmpIn, end);
+        tmpOut = modex->decrypt(cipher, end);
         break;
     case StateError:
     default:
         return ErrorAlreadyError;
     }
-    if ( ! remainingFromHeader.isEmpty() ) {
-        tmpOut.prepend(remainingFromHeader);
-    }
     if (end) {
         state = StateReset;
     }
@@ -480,13 +740,87 @@ public:
 
 /* *** DECRYPTOR WIZARD *** */
 
+/*
+ * Cheap check before a full Decryptor is made: decrypts only the first
+ * block after the IV (one block operation) and compares it with the
+ * start of the header this key/algorithm/mode would have produced.
+ * Returns true when the data is too short to tell.
+ */
+static bool wizard_probe(const QByteArray &cipher, QSharedPointer<Key> key, Algorithm a, Mode m) {
+    const int bs = block_size(a);
+    const QByteArray header = Info::header(a, m);
+    if ( 0 == bs || header.isEmpty() ) return false;
+    if ( cipher.size() < 2*bs ) return true;
+
+    const uchar *iv = (const uchar *)cipher.constData();
+    const uchar *c0 = iv + bs;
+    uchar block[16];
+
+    if ( ModeCBC == m ) {
+        switch (a) {
+#ifdef WITHRC5
+        case RC5_32_32_20:
+            key->expandKeyRc532();
+            rc5_32_decrypt_8b(c0, block, key->s32);
+            break;
+        case RC5_64_32_20:
+            key->expandKeyRc564();
+            rc5_64_decrypt_16b(c0, block, key->s64);
+            break;
+#endif
+        case SERPENT_32:
+            key->expandKeySerpent();
+            serpent_decrypt_16b(c0, block, key->serpent);
+            break;
+        default:
+            return false;
+        }
+        xor_bytes(block, iv, bs);
+    } else {
+        // CFB and CTR both start with E(IV) as keystream
+        switch (a) {
+#ifdef WITHRC5
+        case RC5_32_32_20:
+            key->expandKeyRc532();
+            rc5_32_encrypt_8b(iv, block, key->s32);
+            break;
+        case RC5_64_32_20:
+            key->expandKeyRc564();
+            rc5_64_encrypt_16b(iv, block, key->s64);
+            break;
+#endif
+        case SERPENT_32:
+            key->expandKeySerpent();
+            serpent_encrypt_16b(iv, block, key->serpent);
+            break;
+        default:
+            return false;
+        }
+        xor_bytes(block, c0, bs);
+    }
+
+    const int n = qMin(bs, header.size());
+    return 0 == memcmp(block, header.constData(), n);
+}
+
 DecryptorWizard::DecryptorWizard() {
+    init();
 }
 
 DecryptorWizard::DecryptorWizard(QSharedPointer<Key> k, Algorithm a, Mode m) {
+    init();
     addParameters(k, a, m);
 }
 
+void DecryptorWizard::init() {
+    lastEntry = -1;
+    lastAlgorithm = NoAlgorithm;
+    lastMode = NoMode;
+    candidatesTried = 0;
+    candidatesProbed = 0;
+    candidatesDecrypted = 0;
+}
+
 DecryptorWizard::~DecryptorWizard() {
     for ( int i=0 ; i < entries.size() ; i++ ) {
         delete entries.at(i);
@@ -501,6 +835,18 @@ void DecryptorWizard::addParameters(QSharedPointer<Key> k, Algorithm a, Mode m)
     entries.append(dwe);
 }
 
+int DecryptorWizard::getCandidatesTried() const {
+    return candidatesTried;
+}
+
+int DecryptorWizard::getCandidatesProbed() const {
+    return candidatesProbed;
+}
+
+int DecryptorWizard::getCandidatesDecrypted() const {
+    return candidatesDecrypted;
+}
+
 Error DecryptorWizard::decrypt(const QByteArray &cipher, QByteArray &plain, QSharedPointer<Decryptor> &decryptor, bool end) {
 #ifdef WITHRC5
     Algorithm aList[3] = { RC5_32_32_20, RC5_64_32_20, SERPENT_32 };
@@ -509,36 +855,64 @@ Error DecryptorWizard::decrypt(const QByteArray &cipher, QByteArray &plain, QSha
     Algorithm aList[1] = { SERPENT_32 };
     int aL = 1;
 #endif
-    Mode mList[2] = { ModeCBC, ModeCFB };
-    int mL = 2;
+    Mode mList[3] = { ModeCBC, ModeCFB, ModeCTR };
+    int mL = 3;
     int eL = entries.size();
     int eI, aI, mI;
+    int bs;
     Decryptor *dx;
     Error dxError;
     Error retError = ErrorInvalidKey;
 
-    for (eI=0 ; eI<eL ; eI++) for (aI=0 ; aI<aL ; aI++) for (mI=0 ; mI<mL ; mI++) {
-        if ( (entries.at(eI)->alg != aList[aI]) && (entries.at(eI)->alg != DetectAlgorithm) ) continue;
-        if ( (entries.at(eI)->mode != mList[mI]) && (entries.at(eI)->mode != DetectMode) ) continue;
-        dx = new Decryptor(entries.at(eI)->key, aList[aI], mList[mI]);
-        dxError = dx->decrypt(cipher, plain, end);
-        switch (dxError) {
-        case NoError:
-            decryptor = QSharedPointer<Decryptor>(dx);
-            return NoError;
-        case ErrorNotEnoughData:
-            retError = ErrorNotEnoughData;
-            break;
-        case ErrorInvalidKey:
-            if ( ErrorNotEnoughData != retError ) {
-                retError = ErrorInvalidKey;
+    candidatesTried = 0;
+    candidatesProbed = 0;
+    candidatesDecrypted = 0;
+
+    // the combination that worked last time goes first, pass -1 is it
+    for (int pass = -1 ; pass < eL ; pass++) {
+        if ( -1 == pass && ( lastEntry < 0 || lastEntry >= eL ) ) continue;
+        eI = ( -1 == pass ) ? lastEntry : pass;
+        for (aI=0 ; aI<aL ; aI++) for (mI=0 ; mI<mL ; mI++) {
+            const bool last = ( eI == lastEntry && aList[aI] == lastAlgorithm && mList[mI] == lastMode );
+            if ( ( -1 == pass ) != last ) continue;
+            if ( (entries.at(eI)->alg != aList[aI]) && (entries.at(eI)->alg != DetectAlgorithm) ) continue;
+            if ( (entries.at(eI)->mode != mList[mI]) && (entries.at(eI)->mode != DetectMode) ) continue;
+            // no counter mode for 8 byte blocks
+            if ( ModeCTR == mList[mI] && 0 == CTR::blockSize(aList[aI]) ) continue;
+
+            candidatesTried++;
+
+            // a complete CBC message is IV + whole blocks
+            bs = block_size(aList[aI]);
+            if ( end && ModeCBC == mList[mI] && 0 != cipher.size() % bs ) continue;
+
+            candidatesProbed++;
+            if ( ! wizard_probe(cipher, entries.at(eI)->key, aList[aI], mList[mI]) ) continue;
+
+            candidatesDecrypted++;
+            dx = new Decryptor(entries.at(eI)->key, aList[aI], mList[mI]);
+            dxError = dx->decrypt(cipher, plain, end);
+            switch (dxError) {
+            case NoError:
+                lastEntry = eI;
+                lastAlgorithm = aList[aI];
+                lastMode = mList[mI];
+                decryptor = QSharedPointer<Decryptor>(dx);
+                return NoError;
+            case ErrorNotEnoughData:
+                retError = ErrorNotEnoughData;
+                break;
+            case ErrorInvalidKey:
+                if ( ErrorNotEnoughData != retError ) {
+                    retError = ErrorInvalidKey;
+                }
+                break;
+            default:
+                delete dx;
+                return dxError;
             }
-            break;
-        default:
             delete dx;
-            return dxError;
         }
-        delete dx;
     }
     return retError;
 }
@@ -576,333 +950,494 @@ QByteArray InitializationVector::getVector16() {
     return ret;
 }
 
+/*
+ * 8 bytes from the system CSPRNG, for the nonce of the counter mode.
+ * Empty when there is no secure source.
+ */
+QByteArray InitializationVector::getNonce8() {
+    QByteArray ret(8, 0);
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 10, 0))
+    qToLittleEndian<quint64>(QRandomGenerator::system()->generate64(), (uchar *)(ret.data()));
+#else
+    QFile urandom("/dev/urandom");
+    if ( ! urandom.open(QFile::ReadOnly) || urandom.read(ret.data(), 8) != 8 ) {
+        return QByteArray();
+    }
+#endif
+    return ret;
+}
+
 void InitializationVector::initiate() {
     qsrand((quint32)(QTime::currentTime().msecsTo(QTime(23,59,59,999))));
 }
 
-/* *** CBC *** */
+/* *** LAYER MODE *** */
 
-CBC::CBC(QSharedPointer<Key> k, Algorithm a) {
-    algorithm = a;
-    key = k;
-    reset();
+LayerMode::LayerMode() {
+    parallelThreshold = DEFAULT_PARALLEL_THRESHOLD;
 }
 
-CBC::~CBC() {
+void LayerMode::setParallelThreshold(int bytes) {
+    parallelThreshold = bytes;
 }
 
-void CBC::reset() {
-    worksize = -1;
-    buffer.clear();
-    cbcBuffer.clear();
-    padHostageBuffer.clear();
+int LayerMode::getParallelThreshold() const {
+    return parallelThreshold;
+}
+
+QByteArray LayerMode::encrypt(const QByteArray plain, bool end) {
+    QByteArray cipher(encryptSize(plain.size()), Qt::Uninitialized);
+    cipher.resize( encrypt((const uchar *)plain.constData(), plain.size(), (uchar *)cipher.data(), end) );
+    return cipher;
+}
+
+QByteArray LayerMode::decrypt(const QByteArray cipher, bool end) {
+    QByteArray plain(decryptSize(cipher.size()), Qt::Uninitialized);
+    plain.resize( decrypt((const uchar *)cipher.constData(), cipher.size(), (uchar *)plain.data(), end) );
+    return plain;
+}
+
+int LayerMode::encryptInPlace(uchar *buffer, int len, bool end) {
+    return encrypt(buffer + encryptHeadroom(), len, buffer, end);
 }
 
+int LayerMode::decryptInPlace(uchar *buffer, int len, bool end) {
+    return decrypt(buffer + decryptHeadroom(), len, buffer, end);
+}
+
+
 /*
- *
- * PSEUDO
- *
- * documentation missing
- *
+ * Decrypts a run of whole blocks. chain is the cipher block (or IV)
+ * in front of the first block, so any block aligned part of a
+ * message can be decrypted on its own.
  */
-QByteArray CBC::encrypt(const QByteArray plain, bool end) {
-    int cipherpos = 0;
-    int padsize = -1;
-    bool iv = false;
+void cbc_decrypt_run(Algorithm algorithm, const Key *key, const uchar *chain,
+                     const uchar *cipher, uchar *plain, int blocks) {
+    int worksize = 16;
+    switch (algorithm) {
+#ifdef WITHRC5
+    case RC5_32_32_20:
+        worksize = 8;
+        for ( int i = 0 ; i < blocks ; i++ ) {
+            rc5_32_decrypt_8b(cipher + 8*i, plain + 8*i, key->s32);
+        }
+        break;
+    case RC5_64_32_20:
+        for ( int i = 0 ; i < blocks ; i++ ) {
+            rc5_64_decrypt_16b(cipher + 16*i, plain + 16*i, key->s64);
+        }
+        break;
+#endif
+    case SERPENT_32:
+        serpent_decrypt_blocks(cipher, plain, blocks, key->serpent);
+        break;
+    default:
+        return;
+    }
+    xor_bytes(plain, chain, worksize);
+    xor_bytes(plain + worksize, cipher, (blocks - 1) * worksize);
+}
 
-    // set initialization vector if first data
-    if ( -1 == worksize ) {
-        switch (algorithm) {
+// the key stream of a CFB block is the encrypted cipher block before it
+void cfb_decrypt_run(Algorithm algorithm, const Key *key, const uchar *chain,
+                     const uchar *cipher, uchar *plain, int blocks) {
+    int worksize = 16;
+    switch (algorithm) {
 #ifdef WITHRC5
-        case RC5_32_32_20:
-            cbcBuffer = InitializationVector::getVector8();
-            worksize = 8;
-            iv = true;
-            key->expandKeyRc532();
-            break;
-        case RC5_64_32_20:
-            cbcBuffer = InitializationVector::getVector16();
-            worksize = 16;
-            iv = true;
-            key->expandKeyRc564();
-            break;
+    case RC5_32_32_20:
+        worksize = 8;
+        rc5_32_encrypt_8b(chain, plain, key->s32);
+        for ( int i = 1 ; i < blocks ; i++ ) {
+            rc5_32_encrypt_8b(cipher + 8*(i-1), plain + 8*i, key->s32);
+        }
+        break;
+    case RC5_64_32_20:
+        rc5_64_encrypt_16b(chain, plain, key->s64);
+        for ( int i = 1 ; i < blocks ; i++ ) {
+            rc5_64_encrypt_16b(cipher + 16*(i-1), plain + 16*i, key->s64);
+        }
+        break;
 #endif
-        case SERPENT_32:
-            cbcBuffer = InitializationVector::getVector16();
-            worksize = 16;
-            iv = true;
-            key->expandKeySerpent();
+    case SERPENT_32:
+        serpent_encrypt_16b(chain, plain, key->serpent);
+        serpent_encrypt_blocks(cipher, plain + 16, blocks - 1, key->serpent);
+        break;
+    default:
+        return;
+    }
+    xor_bytes(plain, cipher, blocks * worksize);
+}
+
+typedef void (*DecryptRunFunction)(Algorithm, const Key *, const uchar *, const uchar *, uchar *, int);
+
+class ParallelDecryptJob {
+public:
+    DecryptRunFunction function;
+    Algorithm algorithm;
+    const Key *key;
+    int worksize;
+    const uchar *chain;
+    const uchar *cipher;
+    uchar *plain;
+    int blocks;
+    int segmentBlocks;
+    int segments;
+    QAtomicInt next;
+    QSemaphore finished;
+
+    void work() {
+        int i;
+        while ( (i = next.fetchAndAddRelaxed(1)) < segments ) {
+            int first = i * segmentBlocks;
+            int count = qMin(segmentBlocks, blocks - first);
+            const uchar *segmentChain = first ? cipher + (first - 1) * worksize : chain;
+            function(algorithm, key, segmentChain, cipher + first * worksize,
+                     plain + first * worksize, count);
+        }
+    }
+};
+
+class ParallelDecryptRunnable : public QRunnable {
+public:
+    ParallelDecryptRunnable(ParallelDecryptJob *j) : job(j) {}
+    void run() {
+        job->work();
+        job->finished.release();
+    }
+private:
+    ParallelDecryptJob *job;
+};
+
+/*
+ * Splits a decrypt run into segments and decrypts them on the global
+ * thread pool, writing straight into plain. The calling thread takes
+ * segments as well and helpers are only started on idle pool threads,
+ * so a busy pool never blocks the call.
+ * Returns false (and does nothing) below the threshold.
+ */
+bool parallel_decrypt_run(DecryptRunFunction function, int threshold, Algorithm algorithm,
+                          const Key *key, int worksize, const uchar *chain,
+                          const uchar *cipher, uchar *plain, int blocks) {
+    if ( threshold <= 0 || blocks * worksize < threshold ) return false;
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    int threads = qMax(1, pool->maxThreadCount());
+    int segments = qMin( blocks * worksize / PARALLEL_SEGMENT_SIZE , threads * 4 );
+    if ( segments < 2 ) return false;
+
+    ParallelDecryptJob job;
+    job.function = function;
+    job.algorithm = algorithm;
+    job.key = key;
+    job.worksize = worksize;
+    job.chain = chain;
+    job.cipher = cipher;
+    job.plain = plain;
+    job.blocks = blocks;
+    job.segmentBlocks = (blocks + segments - 1) / segments;
+    job.segments = (blocks + job.segmentBlocks - 1) / job.segmentBlocks;
+
+    int helpers = 0;
+    while ( helpers < qMin(threads, job.segments - 1) ) {
+        ParallelDecryptRunnable *runnable = new ParallelDecryptRunnable(&job);
+        if ( ! pool->tryStart(runnable) ) {
+            delete runnable;
             break;
-        default:
-            buffer.clear();
-            return QByteArray();
         }
+        helpers++;
     }
-    buffer.append(plain);
 
-    int cipherlen = ( buffer.size() / worksize ) * worksize;
-    padsize = worksize - (buffer.size() - cipherlen);
-    if (iv) cipherlen += cbcBuffer.size();
-    if (end) cipherlen += worksize;
+    job.work();
+    job.finished.acquire(helpers);
+    return true;
+}
 
-    QByteArray cipher = QByteArray(cipherlen, 0);
 
-    if (end) {
-        buffer.append(QByteArray(padsize, (char)padsize));
+/*
+ * Decrypts blocks with function and leaves the last cipher block in
+ * chain. When plain overlaps cipher (in place, plain never ahead of
+ * cipher) the run functions would read cipher blocks that are already
+ * written over, so the blocks go through a small copy instead.
+ */
+void decrypt_run(DecryptRunFunction function, int threshold, Algorithm algorithm,
+                 const Key *key, int worksize, uchar *chain,
+                 const uchar *cipher, uchar *plain, int blocks) {
+    if ( blocks <= 0 ) return;
+
+    const int bytes = blocks * worksize;
+    if ( plain + bytes <= cipher || cipher + bytes <= plain ) {
+        if ( ! parallel_decrypt_run(function, threshold, algorithm, key, worksize, chain, cipher, plain, blocks) ) {
+            function(algorithm, key, chain, cipher, plain, blocks);
+        }
+        memcpy(chain, cipher + bytes - worksize, worksize);
+        return;
     }
 
-    if ( iv ) while (cipherpos < worksize) {
-        cipher[cipherpos] = cbcBuffer[cipherpos];
-        cipherpos++;
+    uchar copy[IN_PLACE_RUN_SIZE];
+    const int step = IN_PLACE_RUN_SIZE / worksize;
+    for ( int i = 0 ; i < blocks ; i += step ) {
+        const int n = qMin( step , blocks - i );
+        memcpy(copy, cipher + i * worksize, n * worksize);
+        function(algorithm, key, chain, copy, plain + i * worksize, n);
+        memcpy(chain, copy + (n - 1) * worksize, worksize);
     }
+}
 
-    uchar *bufdat = (uchar *)buffer.data();
-    uchar *cipdat = (uchar *)cipher.data();
-    uchar *cbcdat = (uchar *)cbcBuffer.data();
-    int bufpos = 0;
+/*
+ * Encrypts whole blocks, chain is the IV or last cipher block and is
+ * updated. Every block is read before it is written, so cipher may be
+ * plain (or in front of it) for in place encryption.
+ */
+void cbc_encrypt_run(Algorithm algorithm, const Key *key, uchar *chain,
+                     const uchar *plain, uchar *cipher, int blocks) {
+    if ( blocks <= 0 ) return;
 
     switch (algorithm) {
 #ifdef WITHRC5
     case RC5_32_32_20:
         {
-            quint32 cbc1 = qFromLittleEndian<quint32>(cbcdat);
-            quint32 cbc2 = qFromLittleEndian<quint32>(cbcdat + 4);
-            quint32 buf1;
-            quint32 buf2;
-
-            while ( cipherpos < cipherlen ) {
-                buf1 = qFromLittleEndian<quint32>(bufdat + bufpos);
-                buf2 = qFromLittleEndian<quint32>(bufdat + bufpos + 4);
-                cbc1 ^= buf1;
-                cbc2 ^= buf2;
+            quint32 cbc1 = qFromLittleEndian<quint32>(chain);
+            quint32 cbc2 = qFromLittleEndian<quint32>(chain + 4);
+            for ( int i = 0 ; i < blocks ; i++ ) {
+                cbc1 ^= qFromLittleEndian<quint32>(plain + 8*i);
+                cbc2 ^= qFromLittleEndian<quint32>(plain + 8*i + 4);
                 rc5_32_encrypt_2w(cbc1, cbc2, key->s32);
-                qToLittleEndian(cbc1, cipdat + cipherpos);
-                qToLittleEndian(cbc2, cipdat + cipherpos + 4);
-
-                cipherpos += worksize;
-                bufpos += worksize;
+                qToLittleEndian(cbc1, cipher + 8*i);
+                qToLittleEndian(cbc2, cipher + 8*i + 4);
             }
-
-            qToLittleEndian(cbc1, cbcdat);
-            qToLittleEndian(cbc2, cbcdat + 4);
+            qToLittleEndian(cbc1, chain);
+            qToLittleEndian(cbc2, chain + 4);
         }
         break;
     case RC5_64_32_20:
         {
-            quint64 cbc1 = qFromLittleEndian<quint64>(cbcdat);
-            quint64 cbc2 = qFromLittleEndian<quint64>(cbcdat + 8);
-            quint64 buf1;
-            quint64 buf2;
-
-            while ( cipherpos < cipherlen ) {
-                buf1 = qFromLittleEndian<quint64>(bufdat + bufpos);
-                buf2 = qFromLittleEndian<quint64>(bufdat + bufpos + 8);
-                cbc1 ^= buf1;
-                cbc2 ^= buf2;
+            quint64 cbc1 = qFromLittleEndian<quint64>(chain);
+            quint64 cbc2 = qFromLittleEndian<quint64>(chain + 8);
+            for ( int i = 0 ; i < blocks ; i++ ) {
+                cbc1 ^= qFromLittleEndian<quint64>(plain + 16*i);
+                cbc2 ^= qFromLittleEndian<quint64>(plain + 16*i + 8);
                 rc5_64_encrypt_2w(cbc1, cbc2, key->s64);
-                qToLittleEndian(cbc1, cipdat + cipherpos);
-                qToLittleEndian(cbc2, cipdat + cipherpos + 8);
-
-                cipherpos += worksize;
-                bufpos += worksize;
+                qToLittleEndian(cbc1, cipher + 16*i);
+                qToLittleEndian(cbc2, cipher + 16*i + 8);
             }
-
-            qToLittleEndian(cbc1, cbcdat);
-            qToLittleEndian(cbc2, cbcdat + 8);
+            qToLittleEndian(cbc1, chain);
+            qToLittleEndian(cbc2, chain + 8);
         }
         break;
 #endif
     case SERPENT_32:
         {
-            quint32 cbc1 = qFromLittleEndian<quint32>(cbcdat);
-            quint32 cbc2 = qFromLittleEndian<quint32>(cbcdat + 4);
-            quint32 cbc3 = qFromLittleEndian<quint32>(cbcdat + 8);
-            quint32 cbc4 = qFromLittleEndian<quint32>(cbcdat + 12);
-            quint32 buf1;
-            quint32 buf2;
-            quint32 buf3;
-            quint32 buf4;
-
-            while ( cipherpos < cipherlen ) {
-                buf1 = qFromLittleEndian<quint64>(bufdat + bufpos);
-                buf2 = qFromLittleEndian<quint64>(bufdat + bufpos + 4);
-                buf3 = qFromLittleEndian<quint64>(bufdat + bufpos + 8);
-                buf4 = qFromLittleEndian<quint64>(bufdat + bufpos + 12);
-                cbc1 ^= buf1;
-                cbc2 ^= buf2;
-                cbc3 ^= buf3;
-                cbc4 ^= buf4;
+            quint32 cbc1 = qFromLittleEndian<quint32>(chain);
+            quint32 cbc2 = qFromLittleEndian<quint32>(chain + 4);
+            quint32 cbc3 = qFromLittleEndian<quint32>(chain + 8);
+            quint32 cbc4 = qFromLittleEndian<quint32>(chain + 12);
+            for ( int i = 0 ; i < blocks ; i++ ) {
+                cbc1 ^= qFromLittleEndian<quint32>(plain + 16*i);
+                cbc2 ^= qFromLittleEndian<quint32>(plain + 16*i + 4);
+                cbc3 ^= qFromLittleEndian<quint32>(plain + 16*i + 8);
+                cbc4 ^= qFromLittleEndian<quint32>(plain + 16*i + 12);
                 serpent_encrypt_4w(cbc1, cbc2, cbc3, cbc4, key->serpent);
-                qToLittleEndian(cbc1, cipdat + cipherpos);
-                qToLittleEndian(cbc2, cipdat + cipherpos + 4);
-                qToLittleEndian(cbc3, cipdat + cipherpos + 8);
-                qToLittleEndian(cbc4, cipdat + cipherpos + 12);
-
-                cipherpos += worksize;
-                bufpos += worksize;
+                qToLittleEndian(cbc1, cipher + 16*i);
+                qToLittleEndian(cbc2, cipher + 16*i + 4);
+                qToLittleEndian(cbc3, cipher + 16*i + 8);
+                qToLittleEndian(cbc4, cipher + 16*i + 12);
             }
-
-            qToLittleEndian(cbc1, cbcdat);
-            qToLittleEndian(cbc2, cbcdat + 4);
-            qToLittleEndian(cbc3, cbcdat + 8);
-            qToLittleEndian(cbc4, cbcdat + 12);
+            qToLittleEndian(cbc1, chain);
+            qToLittleEndian(cbc2, chain + 4);
+            qToLittleEndian(cbc3, chain + 8);
+            qToLittleEndian(cbc4, chain + 12);
         }
-	break;
+        break;
     default:
-        cipher.clear();
-        return cipher;
+        break;
     }
+}
 
-    if (end) {
-        reset();
-    } else {
-        buffer = buffer.right( buffer.size() - bufpos );
-    }
-    return cipher;
+
+/* *** CBC *** */
+
+CBC::CBC(QSharedPointer<Key> k, Algorithm a) {
+    algorithm = a;
+    key = k;
+    reset();
+}
+
+CBC::~CBC() {
+}
+
+void CBC::reset() {
+    worksize = -1;
+    buffer.clear();
+    cbcBuffer.clear();
+    padHostageBuffer.clear();
+}
+
+QByteArray CBC::encrypt(const QByteArray plain, bool end) {
+    return LayerMode::encrypt(plain, end);
 }
 
 QByteArray CBC::decrypt(const QByteArray cipher, bool end) {
-    int bufferpos = 0;
+    return LayerMode::decrypt(cipher, end);
+}
+
+// IV, whole blocks of buffered + new data, and a full pad block at most
+int CBC::encryptSize(int len) const {
+    const int bs = block_size(algorithm);
+    if ( 0 == bs ) return 0;
+    return encryptHeadroom() - buffer.size() + ((buffer.size() + len) / bs + 1) * bs;
+}
+
+int CBC::decryptSize(int len) const {
+    return padHostageBuffer.size() + buffer.size() + len;
+}
+
+int CBC::encryptHeadroom() const {
+    return ( -1 == worksize ? block_size(algorithm) : 0 ) + buffer.size();
+}
+
+int CBC::decryptHeadroom() const {
+    return ( -1 == worksize ) ? 0 : padHostageBuffer.size() + buffer.size();
+}
+
+/*
+ * Whole blocks are encrypted straight from plain into cipher, only
+ * an incomplete block at the end is kept in buffer for the next call.
+ */
+int CBC::encrypt(const uchar *plain, int len, uchar *cipher, bool end) {
+    int cipherpos = 0;
     int plainpos = 0;
+    int copysize = 0;
+    int blocks = 0;
 
-    buffer.append(cipher);
+    // set initialization vector if first data
     if ( -1 == worksize ) {
         switch (algorithm) {
 #ifdef WITHRC5
         case RC5_32_32_20:
-            if ( buffer.size() < 8 ) return QByteArray();
-            cbcBuffer = buffer.left(8);
+            cbcBuffer = InitializationVector::getVector8();
             worksize = 8;
-            bufferpos = 8;
             key->expandKeyRc532();
             break;
         case RC5_64_32_20:
-            if ( buffer.size() < 16 ) return QByteArray();
-            cbcBuffer = buffer.left(16);
+            cbcBuffer = InitializationVector::getVector16();
             worksize = 16;
-            bufferpos = 16;
             key->expandKeyRc564();
             break;
 #endif
         case SERPENT_32:
-            if ( buffer.size() < 16 ) return QByteArray();
-            cbcBuffer = buffer.left(16);
+            cbcBuffer = InitializationVector::getVector16();
             worksize = 16;
-            bufferpos = 16;
             key->expandKeySerpent();
             break;
         default:
             buffer.clear();
-            return QByteArray();
+            return 0;
         }
+        memcpy(cipher, cbcBuffer.constData(), worksize);
+        cipherpos = worksize;
     }
 
-    int plainlen = ( (buffer.size() - bufferpos) / worksize ) * worksize + padHostageBuffer.size();
-    QByteArray plain(plainlen, 0);
-    while (plainpos < padHostageBuffer.size()) {
-        plain[plainpos] = padHostageBuffer[plainpos];
-        plainpos++;
-    }
-    padHostageBuffer.clear();
-
-    uchar *bufdat = (uchar *)buffer.data();
-    uchar *plndat = (uchar *)plain.data();
     uchar *cbcdat = (uchar *)cbcBuffer.data();
 
-    switch (algorithm) {
-#ifdef WITHRC5
-    case RC5_32_32_20:
-        {
-            quint32 cbc1 = qFromLittleEndian<quint32>(cbcdat);
-            quint32 cbc2 = qFromLittleEndian<quint32>(cbcdat + 4);
-            quint32 buf1;
-            quint32 buf2;
-            quint32 pln1;
-            quint32 pln2;
-            while ( plainpos < plainlen ) {
-                pln1 = buf1 = qFromLittleEndian<quint32>(bufdat + bufferpos);
-                pln2 = buf2 = qFromLittleEndian<quint32>(bufdat + bufferpos + 4);
-                rc5_32_decrypt_2w(pln1,pln2,key->s32);
-                qToLittleEndian( (pln1 ^ cbc1) , plndat + plainpos);
-                qToLittleEndian( (pln2 ^ cbc2) , plndat + plainpos + 4);
-                cbc1 = buf1;
-                cbc2 = buf2;
-
-                plainpos += worksize;
-                bufferpos += worksize;
-            }
-            qToLittleEndian(cbc1, cbcdat);
-            qToLittleEndian(cbc2, cbcdat + 4);
+    // complete the block left over from the last call
+    if ( ! buffer.isEmpty() ) {
+        copysize = qMin( worksize - buffer.size() , len );
+        buffer.append((const char *)plain, copysize);
+        plainpos = copysize;
+        if ( worksize == buffer.size() ) {
+            cbc_encrypt_run(algorithm, key.data(), cbcdat, (const uchar *)buffer.constData(), cipher + cipherpos, 1);
+            cipherpos += worksize;
+            buffer.clear();
         }
-        break;
-    case RC5_64_32_20:
-        {
-            quint64 cbc1 = qFromLittleEndian<quint64>(cbcdat);
-            quint64 cbc2 = qFromLittleEndian<quint64>(cbcdat + 8);
-            quint64 buf1;
-            quint64 buf2;
-            quint64 pln1;
-            quint64 pln2;
-            while ( plainpos < plainlen ) {
-                pln1 = buf1 = qFromLittleEndian<quint64>(bufdat + bufferpos);
-                pln2 = buf2 = qFromLittleEndian<quint64>(bufdat + bufferpos + 8);
-                rc5_64_decrypt_2w(pln1,pln2,key->s64);
-                qToLittleEndian( (pln1 ^ cbc1) , plndat + plainpos);
-                qToLittleEndian( (pln2 ^ cbc2) , plndat + plainpos + 8);
-                cbc1 = buf1;
-                cbc2 = buf2;
-
-                plainpos += worksize;
-                bufferpos += worksize;
-            }
-            qToLittleEndian(cbc1, cbcdat);
-            qToLittleEndian(cbc2, cbcdat + 8);
+    }
+
+    blocks = (len - plainpos) / worksize;
+    cbc_encrypt_run(algorithm, key.data(), cbcdat, plain + plainpos, cipher + cipherpos, blocks);
+    plainpos += blocks * worksize;
+    cipherpos += blocks * worksize;
+
+    buffer.append((const char *)plain + plainpos, len - plainpos);
+
+    if (end) {
+        const int padsize = worksize - buffer.size();
+        buffer.append(QByteArray(padsize, (char)padsize));
+        cbc_encrypt_run(algorithm, key.data(), cbcdat, (const uchar *)buffer.constData(), cipher + cipherpos, 1);
+        cipherpos += worksize;
+        reset();
+    }
+    return cipherpos;
+}
+
+/*
+ * Whole blocks are decrypted straight from cipher into plain. An
+ * incomplete block at the end waits in buffer, and a last block that
+ * looks like padding waits in padHostageBuffer until we know whether
+ * more data follows.
+ */
+int CBC::decrypt(const uchar *cipher, int len, uchar *plain, bool end) {
+    int cipherpos = 0;
+    int plainpos = 0;
+    int copysize = 0;
+    int blocks = 0;
+
+    if ( -1 == worksize ) {
+        const int bs = block_size(algorithm);
+        if ( 0 == bs ) {
+            buffer.clear();
+            return 0;
         }
-        break;
+        copysize = qMin( bs - buffer.size() , len );
+        buffer.append((const char *)cipher, copysize);
+        cipherpos = copysize;
+        if ( buffer.size() < bs ) return 0;
+
+        switch (algorithm) {
+#ifdef WITHRC5
+        case RC5_32_32_20:
+            key->expandKeyRc532();
+            break;
+        case RC5_64_32_20:
+            key->expandKeyRc564();
+            break;
 #endif
-    case SERPENT_32:
-        {
-            quint32 cbc1 = qFromLittleEndian<quint32>(cbcdat);
-            quint32 cbc2 = qFromLittleEndian<quint32>(cbcdat + 4);
-            quint32 cbc3 = qFromLittleEndian<quint32>(cbcdat + 8);
-            quint32 cbc4 = qFromLittleEndian<quint32>(cbcdat + 12);
-            quint32 buf1;
-            quint32 buf2;
-            quint32 buf3;
-            quint32 buf4;
-            quint32 pln1;
-            quint32 pln2;
-            quint32 pln3;
-            quint32 pln4;
-            while ( plainpos < plainlen ) {
-                pln1 = buf1 = qFromLittleEndian<quint32>(bufdat+bufferpos);
-                pln2 = buf2 = qFromLittleEndian<quint32>(bufdat+bufferpos + 4);
-                pln3 = buf3 = qFromLittleEndian<quint32>(bufdat+bufferpos + 8);
-                pln4 = buf4 = qFromLittleEndian<quint32>(bufdat+bufferpos + 12);
-                serpent_decrypt_4w(pln1,pln2,pln3,pln4,key->serpent);
-                qToLittleEndian( (pln1 ^ cbc1) , plndat + plainpos);
-                qToLittleEndian( (pln2 ^ cbc2) , plndat + plainpos + 4);
-                qToLittleEndian( (pln3 ^ cbc3) , plndat + plainpos + 8);
-                qToLittleEndian( (pln4 ^ cbc4) , plndat + plainpos + 12);
-                cbc1 = buf1;
-                cbc2 = buf2;
-                cbc3 = buf3;
-                cbc4 = buf4;
-
-                plainpos += worksize;
-                bufferpos += worksize;
-            }
-            qToLittleEndian(cbc1, cbcdat);
-            qToLittleEndian(cbc2, cbcdat + 4);
-            qToLittleEndian(cbc3, cbcdat + 8);
-            qToLittleEndian(cbc4, cbcdat + 12);
+        default:
+            key->expandKeySerpent();
+            break;
+        }
+        cbcBuffer = buffer;
+        buffer.clear();
+        worksize = bs;
+    }
+
+    uchar *cbcdat = (uchar *)cbcBuffer.data();
+
+    if ( ! padHostageBuffer.isEmpty() ) {
+        memcpy(plain, padHostageBuffer.constData(), padHostageBuffer.size());
+        plainpos = padHostageBuffer.size();
+        padHostageBuffer.clear();
+    }
+
+    // complete the block left over from the last call
+    if ( ! buffer.isEmpty() ) {
+        copysize = qMin( worksize - buffer.size() , len - cipherpos );
+        buffer.append((const char *)cipher + cipherpos, copysize);
+        cipherpos += copysize;
+        if ( worksize == buffer.size() ) {
+            decrypt_run(cbc_decrypt_run, 0, algorithm, key.data(), worksize, cbcdat,
+                        (const uchar *)buffer.constData(), plain + plainpos, 1);
+            plainpos += worksize;
+            buffer.clear();
         }
-        break;
-    default:
-        plain.clear();
-        return plain;
     }
 
+    blocks = (len - cipherpos) / worksize;
+    decrypt_run(cbc_decrypt_run, parallelThreshold, algorithm, key.data(), worksize, cbcdat,
+                cipher + cipherpos, plain + plainpos, blocks);
+    plainpos += blocks * worksize;
+    cipherpos += blocks * worksize;
+
+    buffer.append((const char *)cipher + cipherpos, len - cipherpos);
+
     if (end) {
         // in case we dont have any valid padding, the only explanation
         // is a transmission error, or someone modified the file
@@ -910,36 +1445,32 @@ QByteArray CBC::decrypt(const QByteArray cipher, bool end) {
         // and I have nowhere to report a problem, so I just need
         // to avoid crashing
         int padc = 0;
-        if ( ! plain.isEmpty() ) {
-            padc = (int)plain[plainlen - 1];
-            if ( padc > plain.size() ) {
+        if ( 0 < plainpos ) {
+            padc = (int)(char)plain[plainpos - 1];
+            if ( padc > plainpos ) {
                 padc = 0;
             }
         }
         if ( 0 < padc && padc <= 16 ) {
-            plain = plain.left(plainlen - padc);
+            plainpos -= padc;
         }
         reset();
-    } else {
-        buffer = buffer.right(buffer.size() - bufferpos);
-
+    } else if ( buffer.isEmpty() && 0 < plainpos ) {
         // there is a chance, that we will not get more data,
         // but end=false anyways. in this case, we must not
         // return possible pad data as plain text
-        if ( buffer.size() == 0 && plainlen > 0 ) {
-            uchar lastByte = plain[plainlen - 1];
-            if ( 0 < lastByte && lastByte <= 16 ) {
-                QByteArray padPattern((int)lastByte,(char)lastByte);
-                if (plain.endsWith(padPattern)) {
-                    padHostageBuffer = plain.right(worksize);
-                    plain = plain.left(plainlen - worksize);
-                    plainlen -= worksize;
-                }
-            }
+        const uchar lastByte = plain[plainpos - 1];
+        bool padding = ( 0 < lastByte && lastByte <= 16 && lastByte <= plainpos );
+        for ( int i = 1 ; padding && i <= lastByte ; i++ ) {
+            padding = ( plain[plainpos - i] == lastByte );
+        }
+        if ( padding ) {
+            padHostageBuffer = QByteArray((const char *)plain + plainpos - worksize, worksize);
+            plainpos -= worksize;
         }
     }
 
-    return plain;
+    return plainpos;
 }
 
 
@@ -959,6 +1490,30 @@ void CFB::reset() {
     buffer.clear();
 }
 
+QByteArray CFB::encrypt(const QByteArray plain, bool end) {
+    return LayerMode::encrypt(plain, end);
+}
+
+QByteArray CFB::decrypt(const QByteArray cipher, bool end) {
+    return LayerMode::decrypt(cipher, end);
+}
+
+int CFB::encryptSize(int len) const {
+    return len + encryptHeadroom();
+}
+
+int CFB::decryptSize(int len) const {
+    return len;
+}
+
+int CFB::encryptHeadroom() const {
+    return ( -1 == bufferpos ) ? block_size(algorithm) : 0;
+}
+
+int CFB::decryptHeadroom() const {
+    return 0;
+}
+
 
 /*
  * PSEUDO:
@@ -976,13 +1531,11 @@ void CFB::reset() {
  *
  *
  */
-QByteArray CFB::encrypt(const QByteArray plain, bool end) {
+int CFB::encrypt(const uchar *plndat, int plainlen, uchar *cphdat, bool end) {
     int plainpos = 0;
-    int plainlen = plain.size();
     int cipherpos = 0;
     int bufferlen = buffer.size();
     int copysize = 0;
-    QByteArray cipher(plainlen, 0);
     uchar *bufdat = 0;
 
     // set initialization vector if first data
@@ -1007,18 +1560,15 @@ QByteArray CFB::encrypt(const QByteArray plain, bool end) {
             break;
         default:
             buffer.clear();
-            return QByteArray();
+            return 0;
         }
-        cipher.prepend(buffer);
+        memcpy(cphdat, buffer.constData(), bufferlen);
         bufferpos = bufferlen;
         cipherpos += bufferlen;
     }
 
     bufdat = (uchar *)(buffer.data());
 
-    uchar *cphdat = (uchar *)cipher.data();
-    uchar *plndat = (uchar *)plain.data();
-
     copysize = qMin( bufferlen - bufferpos , plainlen - plainpos );
     // in case the buffer contains unused data from last encrypt,
     // use those bytes first
@@ -1119,8 +1669,7 @@ QByteArray CFB::encrypt(const QByteArray plain, bool end) {
             }
             break;
         default:
-            cipher.clear();
-            return cipher;
+            return cipherpos;
         }
         bufferpos = bufferlen;
     }
@@ -1161,8 +1710,7 @@ QByteArray CFB::encrypt(const QByteArray plain, bool end) {
             }
             break;
         default:
-            cipher.clear();
-            return cipher;
+            return cipherpos;
         }
         bufferpos = 0;
 
@@ -1179,7 +1727,7 @@ QByteArray CFB::encrypt(const QByteArray plain, bool end) {
     if (end) {
         reset();
     }
-    return cipher;
+    return cipherpos;
 }
 
 
@@ -1200,15 +1748,13 @@ QByteArray CFB::encrypt(const QByteArray plain, bool end) {
  *   buffer = cipher
  *
  */
-QByteArray CFB::decrypt(const QByteArray cipher, bool end) {
+int CFB::decrypt(const uchar *cphdat, int cipherlen, uchar *plndat, bool end) {
     int cipherpos = 0;
-    int cipherlen = cipher.size();
     int bufferlen = -1;
     int copysize = 0;
     int plainpos = 0;
     uchar *bufdat = 0;
-    uchar *cphdat = 0;
-    uchar *plndat = 0;
+    uchar c = 0;
 
     // as long as bufferpos == -1, the initialization vector
     // has not yet been loaded
@@ -1229,30 +1775,29 @@ QByteArray CFB::decrypt(const QByteArray cipher, bool end) {
             bufferlen = 16;
             break;
         default:
-            return QByteArray();
+            return 0;
         }
         copysize = qMin ( bufferlen - buffer.size() , cipherlen );
-        buffer.append(cipher.left(copysize));
+        buffer.append((const char *)cphdat, copysize);
         cipherpos = copysize;
         if ( bufferlen == buffer.size() ) {
             bufferpos = bufferlen;
         } else {
-            return QByteArray();
+            return 0;
         }
     } else {
         bufferlen = buffer.size();
     }
 
-    QByteArray plain(cipherlen - cipherpos, 0);
-
     bufdat = (uchar *)(buffer.data());
-    cphdat = (uchar *)(cipher.data());
-    plndat = (uchar *)(plain.data());
 
+    // plndat may be cphdat (in place), so every cipher byte is read
+    // before the plain byte is written
     copysize = qMin( bufferlen - bufferpos , cipherlen - cipherpos );
     while ( 0 < copysize ) {
-        plndat[plainpos] = buffer[bufferpos] ^ cphdat[cipherpos];
-        buffer[bufferpos] = cphdat[cipherpos];
+        c = cphdat[cipherpos];
+        plndat[plainpos] = bufdat[bufferpos] ^ c;
+        bufdat[bufferpos] = c;
         plainpos++;
         cipherpos++;
         bufferpos++;
@@ -1261,6 +1806,16 @@ QByteArray CFB::decrypt(const QByteArray cipher, bool end) {
 
     copysize = qMin( bufferlen , cipherlen - cipherpos );
 
+    int blocks = (cipherlen - cipherpos) / bufferlen;
+    if ( 0 < blocks && 0 < parallelThreshold && parallelThreshold <= blocks * bufferlen ) {
+        decrypt_run(cfb_decrypt_run, parallelThreshold, algorithm, key.data(), bufferlen,
+                    bufdat, cphdat + cipherpos, plndat + plainpos, blocks);
+        cipherpos += blocks * bufferlen;
+        plainpos += blocks * bufferlen;
+        bufferpos = bufferlen;
+        copysize = qMin( bufferlen , cipherlen - cipherpos );
+    }
+
     if ( bufferlen == copysize ) {
         switch (algorithm) {
 #ifdef WITHRC5
@@ -1317,46 +1872,19 @@ QByteArray CFB::decrypt(const QByteArray cipher, bool end) {
 #endif
         case SERPENT_32:
             {
-                quint32 B1 = qFromLittleEndian<quint32>(bufdat);
-                quint32 B2 = qFromLittleEndian<quint32>(bufdat + 4);
-                quint32 B3 = qFromLittleEndian<quint32>(bufdat + 8);
-                quint32 B4 = qFromLittleEndian<quint32>(bufdat + 12);
-                quint32 C1 = 0;
-                quint32 C2 = 0;
-                quint32 C3 = 0;
-                quint32 C4 = 0;
-
-                do {
-                    serpent_encrypt_4w(B1,B2,B3,B4,key->serpent);
-                    C1 = qFromLittleEndian<quint32>(cphdat + cipherpos);
-                    C2 = qFromLittleEndian<quint32>(cphdat + cipherpos + 4);
-                    C3 = qFromLittleEndian<quint32>(cphdat + cipherpos + 8);
-                    C4 = qFromLittleEndian<quint32>(cphdat + cipherpos + 12);
-                    B1 ^= C1;
-                    B2 ^= C2;
-                    B3 ^= C3;
-                    B4 ^= C4;
-                    qToLittleEndian(B1, plndat + plainpos);
-                    qToLittleEndian(B2, plndat + plainpos + 4);
-                    qToLittleEndian(B3, plndat + plainpos + 8);
-                    qToLittleEndian(B4, plndat + plainpos + 12);
-                    B1 = C1;
-                    B2 = C2;
-                    B3 = C3;
-                    B4 = C4;
-                    cipherpos += copysize;
-                    plainpos += copysize;
-                    copysize = qMin( bufferlen , cipherlen - cipherpos );
-                } while ( bufferlen == copysize );
-                qToLittleEndian(B1, bufdat);
-                qToLittleEndian(B2, bufdat + 4);
-                qToLittleEndian(B3, bufdat + 8);
-                qToLittleEndian(B4, bufdat + 12);
+                // the key stream of block N is the encrypted cipher block N-1,
+                // so everything but the first block is one multi block call
+                blocks = (cipherlen - cipherpos) / bufferlen;
+                decrypt_run(cfb_decrypt_run, 0, algorithm, key.data(), bufferlen,
+                            bufdat, cphdat + cipherpos, plndat + plainpos, blocks);
+
+                cipherpos += blocks * bufferlen;
+                plainpos += blocks * bufferlen;
+                copysize = qMin( bufferlen , cipherlen - cipherpos );
             }
             break;
         default:
-            plain.clear();
-            return plain;
+            return plainpos;
         }
         bufferpos = bufferlen;
     }
@@ -1397,14 +1925,14 @@ QByteArray CFB::decrypt(const QByteArray cipher, bool end) {
             }
             break;
         default:
-            plain.clear();
-            return plain;
+            return plainpos;
         }
         bufferpos = 0;
 
         while ( 0 < copysize ) {
-            plndat[plainpos] = buffer[bufferpos] ^ cphdat[cipherpos];
-            buffer[bufferpos] = cphdat[cipherpos];
+            c = cphdat[cipherpos];
+            plndat[plainpos] = bufdat[bufferpos] ^ c;
+            bufdat[bufferpos] = c;
             plainpos++;
             cipherpos++;
             bufferpos++;
@@ -1416,7 +1944,183 @@ QByteArray CFB::decrypt(const QByteArray cipher, bool end) {
     if (end) {
         reset();
     }
-    return plain;
+    return plainpos;
+}
+
+
+/* *** CTR *** */
+
+CTR::CTR(QSharedPointer<Key> k, Algorithm a) {
+    algorithm = a;
+    key = k;
+    blocksize = blockSize(a);
+    reset();
+}
+
+CTR::~CTR() {
+}
+
+void CTR::reset() {
+    iv.clear();
+    pos = 0;
+}
+
+/*
+ * Only 16 byte blocks leave room for a 64 bit nonce next to the 64 bit
+ * block counter, so RC5 with 8 byte blocks has no counter mode.
+ */
+int CTR::blockSize(Algorithm a) {
+    return (16 == block_size(a)) ? 16 : 0;
+}
+
+QByteArray CTR::getIv() const {
+    return iv;
+}
+
+void CTR::setIv(const QByteArray &v) {
+    iv = v;
+}
+
+qint64 CTR::position() const {
+    return pos;
+}
+
+void CTR::seek(qint64 p) {
+    pos = p;
+}
+
+QByteArray CTR::encrypt(const QByteArray plain, bool end) {
+    return LayerMode::encrypt(plain, end);
+}
+
+QByteArray CTR::decrypt(const QByteArray cipher, bool end) {
+    return LayerMode::decrypt(cipher, end);
+}
+
+int CTR::encryptSize(int len) const {
+    return len + encryptHeadroom();
+}
+
+int CTR::decryptSize(int len) const {
+    return len;
+}
+
+int CTR::encryptHeadroom() const {
+    return iv.isEmpty() ? blocksize : 0;
+}
+
+int CTR::decryptHeadroom() const {
+    return 0;
+}
+
+/*
+ * The IV goes in front of the stream, everything after it is
+ * plain XOR keystream.
+ */
+int CTR::encrypt(const uchar *plain, int len, uchar *cipher, bool end) {
+    int cipherpos = 0;
+    if ( 0 == blocksize ) return 0;
+
+    if ( iv.isEmpty() ) {
+        const QByteArray nonce = InitializationVector::getNonce8();
+        if ( nonce.isEmpty() ) return 0;
+        iv = QByteArray(8, 0) + nonce;
+        memcpy(cipher, iv.constData(), blocksize);
+        cipherpos = blocksize;
+    }
+
+    crypt(plain, cipher + cipherpos, len, pos);
+    pos += len;
+
+    if (end) {
+        reset();
+    }
+    return cipherpos + len;
+}
+
+int CTR::decrypt(const uchar *cipher, int len, uchar *plain, bool end) {
+    int cipherpos = 0;
+    int plainlen = 0;
+    if ( 0 == blocksize ) return 0;
+
+    if ( iv.size() < blocksize ) {
+        cipherpos = qMin(blocksize - iv.size(), len);
+        iv.append((const char *)cipher, cipherpos);
+    }
+
+    if ( iv.size() == blocksize ) {
+        plainlen = len - cipherpos;
+        crypt(cipher + cipherpos, plain, plainlen, pos);
+        pos += plainlen;
+    }
+
+    if (end) {
+        reset();
+    }
+    return plainlen;
+}
+
+/*
+ * Counter block i is i in the first 8 bytes (little endian) and the
+ * random nonce of the IV in the last 8. The first half of the IV is not
+ * used, so the counter always starts at 0 and ranges of two streams
+ * only meet when their 64 bit nonces do. Keystream is made
+ * CTR_BATCH_BLOCKS blocks at a time so Serpent can use the multi-block
+ * kernel.
+ */
+void CTR::crypt(const uchar *in, uchar *out, int len, qint64 p) const {
+    if ( len <= 0 || iv.size() != blocksize ) return;
+
+    switch (algorithm) {
+#ifdef WITHRC5
+    case RC5_64_32_20:
+        key->expandKeyRc564();
+        break;
+#endif
+    case SERPENT_32:
+        key->expandKeySerpent();
+        break;
+    default:
+        return;
+    }
+
+    uchar stream[CTR_BATCH_BLOCKS * 16];
+    const uchar *ivdat = (const uchar *)iv.constData();
+    quint64 block = p / blocksize;
+    int skip = p % blocksize;
+    int done = 0;
+
+    while ( done < len ) {
+        const int blocks = qMin<qint64>(CTR_BATCH_BLOCKS, (skip + len - done + blocksize - 1) / blocksize);
+        for ( int i = 0 ; i < blocks ; i++ ) {
+            uchar *counter = stream + i*blocksize;
+            memcpy(counter + 8, ivdat + 8, 8);
+            qToLittleEndian<quint64>(block + i, counter);
+        }
+
+        switch (algorithm) {
+#ifdef WITHRC5
+        case RC5_64_32_20:
+            for ( int i = 0 ; i < blocks ; i++ ) {
+                rc5_64_encrypt_16b(stream + 16*i, stream + 16*i, key->s64);
+            }
+            break;
+#endif
+        case SERPENT_32:
+            serpent_encrypt_blocks(stream, stream, blocks, key->serpent);
+            break;
+        default:
+            return;
+        }
+
+        const int n = qMin(blocks*blocksize - skip, len - done);
+        for ( int i = 0 ; i < n ; i++ ) {
+            out[done + i] = in[done + i] ^ stream[skip + i];
+        }
+        done += n;
+        block += blocks;
+        skip = 0;
+    }
 }
 
 
@@ -1765,6 +2469,397 @@ void serpent_decrypt_16b(const uchar *cipher16, uchar *plain16, const quint32 *s
 }
 
 
+/*
+ * MULTI BLOCK SERPENT
+ *
+ * Serpent as implemented here applies its S-boxes as a bit permutation
+ * inside each 16 bit half of a word. A permutation can be written as a
+ * few (word & mask) << shift terms, which works on any number of words
+ * at once. The SIMD kernels keep word N of 4 (SSE2) or 8 (AVX2) blocks
+ * in one register, so every operation handles all blocks together.
+ */
+
+inline quint32 serpent_sbox_word(int sbox, quint32 X) {
+#ifdef WITH_SERPENT_FAST_SBOX
+    return serpent_sbox_fast(sbox, X);
+#else
+    quint32 X2 = 0, X3 = 0, X4 = 0;
+    serpent_sbox_it(sbox, X, X2, X3, X4);
+    return X;
+#endif
+}
+
+class SerpentPermutation {
+public:
+    SerpentPermutation() {
+        for ( int sbox = 0 ; sbox < 16 ; sbox++ ) {
+            quint32 masks[31];
+            for ( int d = 0 ; d < 31 ; d++ ) {
+                masks[d] = 0;
+            }
+            for ( int b = 0 ; b < 16 ; b++ ) {
+                quint32 out = serpent_sbox_word(sbox, 1u << b);
+                int o = 0;
+                while ( o < 15 && !(out & (1u << o)) ) o++;
+                masks[o - b + 15] |= (1u << b) | (1u << (b + 16));
+            }
+
+            count[sbox] = 0;
+            for ( int d = 0 ; d < 31 ; d++ ) {
+                if ( !masks[d] ) continue;
+                shift[sbox][count[sbox]] = d - 15;
+                mask[sbox][count[sbox]] = masks[d];
+                count[sbox]++;
+            }
+        }
+    }
+
+    int count[16];
+    int shift[16][16];
+    quint32 mask[16][16];
+};
+
+const SerpentPermutation &serpent_permutation() {
+    static const SerpentPermutation permutation;
+    return permutation;
+}
+
+#ifdef WITH_SERPENT_SSE2
+
+#define SSE2_ROTL(X,N) _mm_or_si128(_mm_slli_epi32((X),(N)), _mm_srli_epi32((X),32-(N)))
+#define SSE2_ROTR(X,N) _mm_or_si128(_mm_srli_epi32((X),(N)), _mm_slli_epi32((X),32-(N)))
+
+inline void serpent_sbox_sse2(const SerpentPermutation &p, int sbox,
+                              __m128i &X1, __m128i &X2, __m128i &X3, __m128i &X4) {
+    __m128i R1 = _mm_setzero_si128();
+    __m128i R2 = _mm_setzero_si128();
+    __m128i R3 = _mm_setzero_si128();
+    __m128i R4 = _mm_setzero_si128();
+    for ( int i = 0 ; i < p.count[sbox] ; i++ ) {
+        const __m128i M = _mm_set1_epi32(p.mask[sbox][i]);
+        const int d = p.shift[sbox][i];
+        if ( d >= 0 ) {
+            const __m128i D = _mm_cvtsi32_si128(d);
+            R1 = _mm_or_si128(R1, _mm_sll_epi32(_mm_and_si128(X1, M), D));
+            R2 = _mm_or_si128(R2, _mm_sll_epi32(_mm_and_si128(X2, M), D));
+            R3 = _mm_or_si128(R3, _mm_sll_epi32(_mm_and_si128(X3, M), D));
+            R4 = _mm_or_si128(R4, _mm_sll_epi32(_mm_and_si128(X4, M), D));
+        } else {
+            const __m128i D = _mm_cvtsi32_si128(-d);
+            R1 = _mm_or_si128(R1, _mm_srl_epi32(_mm_and_si128(X1, M), D));
+            R2 = _mm_or_si128(R2, _mm_srl_epi32(_mm_and_si128(X2, M), D));
+            R3 = _mm_or_si128(R3, _mm_srl_epi32(_mm_and_si128(X3, M), D));
+            R4 = _mm_or_si128(R4, _mm_srl_epi32(_mm_and_si128(X4, M), D));
+        }
+    }
+    X1 = R1;
+    X2 = R2;
+    X3 = R3;
+    X4 = R4;
+}
+
+// 4x4 transpose, turns 4 blocks into 4 registers of equal words and back
+inline void serpent_transpose_sse2(__m128i &X1, __m128i &X2, __m128i &X3, __m128i &X4) {
+    __m128i T1 = _mm_unpacklo_epi32(X1, X2);
+    __m128i T2 = _mm_unpacklo_epi32(X3, X4);
+    __m128i T3 = _mm_unpackhi_epi32(X1, X2);
+    __m128i T4 = _mm_unpackhi_epi32(X3, X4);
+    X1 = _mm_unpacklo_epi64(T1, T2);
+    X2 = _mm_unpackhi_epi64(T1, T2);
+    X3 = _mm_unpacklo_epi64(T3, T4);
+    X4 = _mm_unpackhi_epi64(T3, T4);
+}
+
+void serpent_encrypt_64b_sse2(const uchar *plain64, uchar *cipher64, const quint32 *s) {
+    const SerpentPermutation &p = serpent_permutation();
+    __m128i X1 = _mm_loadu_si128((const __m128i *)(plain64));
+    __m128i X2 = _mm_loadu_si128((const __m128i *)(plain64 + 16));
+    __m128i X3 = _mm_loadu_si128((const __m128i *)(plain64 + 32));
+    __m128i X4 = _mm_loadu_si128((const __m128i *)(plain64 + 48));
+    serpent_transpose_sse2(X1, X2, X3, X4);
+
+    int round = 0;
+    while ( 1 ) {
+        X1 = _mm_xor_si128(X1, _mm_set1_epi32(s[4*round    ]));
+        X2 = _mm_xor_si128(X2, _mm_set1_epi32(s[4*round + 1]));
+        X3 = _mm_xor_si128(X3, _mm_set1_epi32(s[4*round + 2]));
+        X4 = _mm_xor_si128(X4, _mm_set1_epi32(s[4*round + 3]));
+
+        int rm8 = round & 0x7;
+        serpent_sbox_sse2(p, rm8, X1, X2, X3, X4);
+        if ( round == ROUNDS-1 ) break;
+
+        X1 = SSE2_ROTL(X1, 13);
+        X3 = SSE2_ROTL(X3, 3);
+        X2 = _mm_xor_si128(_mm_xor_si128(X2, X1), X3);
+        X4 = _mm_xor_si128(_mm_xor_si128(X4, X3), _mm_slli_epi32(X1, 3));
+        X2 = SSE2_ROTL(X2, 1);
+        X4 = SSE2_ROTL(X4, 7);
+        X1 = _mm_xor_si128(_mm_xor_si128(X1, X2), X4);
+        X3 = _mm_xor_si128(_mm_xor_si128(X3, X4), _mm_slli_epi32(X2, 7));
+        X1 = SSE2_ROTL(X1, 5);
+        X3 = SSE2_ROTL(X3, 22);
+
+        round++;
+    }
+
+    X1 = _mm_xor_si128(X1, _mm_set1_epi32(s[128]));
+    X2 = _mm_xor_si128(X2, _mm_set1_epi32(s[129]));
+    X3 = _mm_xor_si128(X3, _mm_set1_epi32(s[130]));
+    X4 = _mm_xor_si128(X4, _mm_set1_epi32(s[131]));
+
+    serpent_transpose_sse2(X1, X2, X3, X4);
+    _mm_storeu_si128((__m128i *)(cipher64), X1);
+    _mm_storeu_si128((__m128i *)(cipher64 + 16), X2);
+    _mm_storeu_si128((__m128i *)(cipher64 + 32), X3);
+    _mm_storeu_si128((__m128i *)(cipher64 + 48), X4);
+}
+
+void serpent_decrypt_64b_sse2(const uchar *cipher64, uchar *plain64, const quint32 *s) {
+    const SerpentPermutation &p = serpent_permutation();
+    __m128i X1 = _mm_loadu_si128((const __m128i *)(cipher64));
+    __m128i X2 = _mm_loadu_si128((const __m128i *)(cipher64 + 16));
+    __m128i X3 = _mm_loadu_si128((const __m128i *)(cipher64 + 32));
+    __m128i X4 = _mm_loadu_si128((const __m128i *)(cipher64 + 48));
+    serpent_transpose_sse2(X1, X2, X3, X4);
+
+    X1 = _mm_xor_si128(X1, _mm_set1_epi32(s[128]));
+    X2 = _mm_xor_si128(X2, _mm_set1_epi32(s[129]));
+    X3 = _mm_xor_si128(X3, _mm_set1_epi32(s[130]));
+    X4 = _mm_xor_si128(X4, _mm_set1_epi32(s[131]));
+
+    int round = ROUNDS - 1;
+    while ( 1 ) {
+        int rm8 = (round & 0x7) + 8;
+        serpent_sbox_sse2(p, rm8, X1, X2, X3, X4);
+
+        X1 = _mm_xor_si128(X1, _mm_set1_epi32(s[4*round    ]));
+        X2 = _mm_xor_si128(X2, _mm_set1_epi32(s[4*round + 1]));
+        X3 = _mm_xor_si128(X3, _mm_set1_epi32(s[4*round + 2]));
+        X4 = _mm_xor_si128(X4, _mm_set1_epi32(s[4*round + 3]));
+
+        round--;
+        if ( -1 == round ) break;
+
+        X3 = SSE2_ROTR(X3, 22);
+        X1 = SSE2_ROTR(X1, 5);
+        X3 = _mm_xor_si128(_mm_xor_si128(X3, X4), _mm_slli_epi32(X2, 7));
+        X1 = _mm_xor_si128(_mm_xor_si128(X1, X2), X4);
+        X4 = SSE2_ROTR(X4, 7);
+        X2 = SSE2_ROTR(X2, 1);
+        X4 = _mm_xor_si128(_mm_xor_si128(X4, X3), _mm_slli_epi32(X1, 3));
+        X2 = _mm_xor_si128(_mm_xor_si128(X2, X1), X3);
+        X3 = SSE2_ROTR(X3, 3);
+        X1 = SSE2_ROTR(X1, 13);
+    }
+
+    serpent_transpose_sse2(X1, X2, X3, X4);
+    _mm_storeu_si128((__m128i *)(plain64), X1);
+    _mm_storeu_si128((__m128i *)(plain64 + 16), X2);
+    _mm_storeu_si128((__m128i *)(plain64 + 32), X3);
+    _mm_storeu_si128((__m128i *)(plain64 + 48), X4);
+}
+
+#endif // WITH_SERPENT_SSE2
+
+
+#ifdef WITH_SERPENT_AVX2
+
+#define AVX2_ROTL(X,N) _mm256_or_si256(_mm256_slli_epi32((X),(N)), _mm256_srli_epi32((X),32-(N)))
+#define AVX2_ROTR(X,N) _mm256_or_si256(_mm256_srli_epi32((X),(N)), _mm256_slli_epi32((X),32-(N)))
+#define AVX2_LOAD2(LO,HI) _mm256_inserti128_si256(_mm256_castsi128_si256( \
+                              _mm_loadu_si128((const __m128i *)(LO))), _mm_loadu_si128((const __m128i *)(HI)), 1)
+#define AVX2_STORE2(LO,HI,X) do { _mm_storeu_si128((__m128i *)(LO), _mm256_castsi256_si128(X)); \
+                                  _mm_storeu_si128((__m128i *)(HI), _mm256_extracti128_si256((X), 1)); } while(0)
+
+bool serpent_has_avx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+__attribute__((target("avx2")))
+inline void serpent_sbox_avx2(const SerpentPermutation &p, int sbox,
+                              __m256i &X1, __m256i &X2, __m256i &X3, __m256i &X4) {
+    __m256i R1 = _mm256_setzero_si256();
+    __m256i R2 = _mm256_setzero_si256();
+    __m256i R3 = _mm256_setzero_si256();
+    __m256i R4 = _mm256_setzero_si256();
+    for ( int i = 0 ; i < p.count[sbox] ; i++ ) {
+        const __m256i M = _mm256_set1_epi32(p.mask[sbox][i]);
+        const int d = p.shift[sbox][i];
+        if ( d >= 0 ) {
+            const __m128i D = _mm_cvtsi32_si128(d);
+            R1 = _mm256_or_si256(R1, _mm256_sll_epi32(_mm256_and_si256(X1, M), D));
+            R2 = _mm256_or_si256(R2, _mm256_sll_epi32(_mm256_and_si256(X2, M), D));
+            R3 = _mm256_or_si256(R3, _mm256_sll_epi32(_mm256_and_si256(X3, M), D));
+            R4 = _mm256_or_si256(R4, _mm256_sll_epi32(_mm256_and_si256(X4, M), D));
+        } else {
+            const __m128i D = _mm_cvtsi32_si128(-d);
+            R1 = _mm256_or_si256(R1, _mm256_srl_epi32(_mm256_and_si256(X1, M), D));
+            R2 = _mm256_or_si256(R2, _mm256_srl_epi32(_mm256_and_si256(X2, M), D));
+            R3 = _mm256_or_si256(R3, _mm256_srl_epi32(_mm256_and_si256(X3, M), D));
+            R4 = _mm256_or_si256(R4, _mm256_srl_epi32(_mm256_and_si256(X4, M), D));
+        }
+    }
+    X1 = R1;
+    X2 = R2;
+    X3 = R3;
+    X4 = R4;
+}
+
+// loads blocks N and N+4 in the two lanes, then transposes each lane
+__attribute__((target("avx2")))
+inline void serpent_load_avx2(const uchar *in128, __m256i &X1, __m256i &X2, __m256i &X3, __m256i &X4) {
+    X1 = AVX2_LOAD2(in128, in128 + 64);
+    X2 = AVX2_LOAD2(in128 + 16, in128 + 80);
+    X3 = AVX2_LOAD2(in128 + 32, in128 + 96);
+    X4 = AVX2_LOAD2(in128 + 48, in128 + 112);
+    __m256i T1 = _mm256_unpacklo_epi32(X1, X2);
+    __m256i T2 = _mm256_unpacklo_epi32(X3, X4);
+    __m256i T3 = _mm256_unpackhi_epi32(X1, X2);
+    __m256i T4 = _mm256_unpackhi_epi32(X3, X4);
+    X1 = _mm256_unpacklo_epi64(T1, T2);
+    X2 = _mm256_unpackhi_epi64(T1, T2);
+    X3 = _mm256_unpacklo_epi64(T3, T4);
+    X4 = _mm256_unpackhi_epi64(T3, T4);
+}
+
+__attribute__((target("avx2")))
+inline void serpent_store_avx2(uchar *out128, __m256i X1, __m256i X2, __m256i X3, __m256i X4) {
+    __m256i T1 = _mm256_unpacklo_epi32(X1, X2);
+    __m256i T2 = _mm256_unpacklo_epi32(X3, X4);
+    __m256i T3 = _mm256_unpackhi_epi32(X1, X2);
+    __m256i T4 = _mm256_unpackhi_epi32(X3, X4);
+    X1 = _mm256_unpacklo_epi64(T1, T2);
+    X2 = _mm256_unpackhi_epi64(T1, T2);
+    X3 = _mm256_unpacklo_epi64(T3, T4);
+    X4 = _mm256_unpackhi_epi64(T3, T4);
+    AVX2_STORE2(out128, out128 + 64, X1);
+    AVX2_STORE2(out128 + 16, out128 + 80, X2);
+    AVX2_STORE2(out128 + 32, out128 + 96, X3);
+    AVX2_STORE2(out128 + 48, out128 + 112, X4);
+}
+
+__attribute__((target("avx2")))
+void serpent_encrypt_128b_avx2(const uchar *plain128, uchar *cipher128, const quint32 *s) {
+    const SerpentPermutation &p = serpent_permutation();
+    __m256i X1, X2, X3, X4;
+    serpent_load_avx2(plain128, X1, X2, X3, X4);
+
+    int round = 0;
+    while ( 1 ) {
+        X1 = _mm256_xor_si256(X1, _mm256_set1_epi32(s[4*round    ]));
+        X2 = _mm256_xor_si256(X2, _mm256_set1_epi32(s[4*round + 1]));
+        X3 = _mm256_xor_si256(X3, _mm256_set1_epi32(s[4*round + 2]));
+        X4 = _mm256_xor_si256(X4, _mm256_set1_epi32(s[4*round + 3]));
+
+        int rm8 = round & 0x7;
+        serpent_sbox_avx2(p, rm8, X1, X2, X3, X4);
+        if ( round == ROUNDS-1 ) break;
+
+        X1 = AVX2_ROTL(X1, 13);
+        X3 = AVX2_ROTL(X3, 3);
+        X2 = _mm256_xor_si256(_mm256_xor_si256(X2, X1), X3);
+        X4 = _mm256_xor_si256(_mm256_xor_si256(X4, X3), _mm256_slli_epi32(X1, 3));
+        X2 = AVX2_ROTL(X2, 1);
+        X4 = AVX2_ROTL(X4, 7);
+        X1 = _mm256_xor_si256(_mm256_xor_si256(X1, X2), X4);
+        X3 = _mm256_xor_si256(_mm256_xor_si256(X3, X4), _mm256_slli_epi32(X2, 7));
+        X1 = AVX2_ROTL(X1, 5);
+        X3 = AVX2_ROTL(X3, 22);
+
+        round++;
+    }
+
+    X1 = _mm256_xor_si256(X1, _mm256_set1_epi32(s[128]));
+    X2 = _mm256_xor_si256(X2, _mm256_set1_epi32(s[129]));
+    X3 = _mm256_xor_si256(X3, _mm256_set1_epi32(s[130]));
+    X4 = _mm256_xor_si256(X4, _mm256_set1_epi32(s[131]));
+
+    serpent_store_avx2(cipher128, X1, X2, X3, X4);
+}
+
+__attribute__((target("avx2")))
+void serpent_decrypt_128b_avx2(const uchar *cipher128, uchar *plain128, const quint32 *s) {
+    const SerpentPermutation &p = serpent_permutation();
+    __m256i X1, X2, X3, X4;
+    serpent_load_avx2(cipher128, X1, X2, X3, X4);
+
+    X1 = _mm256_xor_si256(X1, _mm256_set1_epi32(s[128]));
+    X2 = _mm256_xor_si256(X2, _mm256_set1_epi32(s[129]));
+    X3 = _mm256_xor_si256(X3, _mm256_set1_epi32(s[130]));
+    X4 = _mm256_xor_si256(X4, _mm256_set1_epi32(s[131]));
+
+    int round = ROUNDS - 1;
+    while ( 1 ) {
+        int rm8 = (round & 0x7) + 8;
+        serpent_sbox_avx2(p, rm8, X1, X2, X3, X4);
+
+        X1 = _mm256_xor_si256(X1, _mm256_set1_epi32(s[4*round    ]));
+        X2 = _mm256_xor_si256(X2, _mm256_set1_epi32(s[4*round + 1]));
+        X3 = _mm256_xor_si256(X3, _mm256_set1_epi32(s[4*round + 2]));
+        X4 = _mm256_xor_si256(X4, _mm256_set1_epi32(s[4*round + 3]));
+
+        round--;
+        if ( -1 == round ) break;
+
+        X3 = AVX2_ROTR(X3, 22);
+        X1 = AVX2_ROTR(X1, 5);
+        X3 = _mm256_xor_si256(_mm256_xor_si256(X3, X4), _mm256_slli_epi32(X2, 7));
+        X1 = _mm256_xor_si256(_mm256_xor_si256(X1, X2), X4);
+        X4 = AVX2_ROTR(X4, 7);
+        X2 = AVX2_ROTR(X2, 1);
+        X4 = _mm256_xor_si256(_mm256_xor_si256(X4, X3), _mm256_slli_epi32(X1, 3));
+        X2 = _mm256_xor_si256(_mm256_xor_si256(X2, X1), X3);
+        X3 = AVX2_ROTR(X3, 3);
+        X1 = AVX2_ROTR(X1, 13);
+    }
+
+    serpent_store_avx2(plain128, X1, X2, X3, X4);
+}
+
+#endif // WITH_SERPENT_AVX2
+
+
+void serpent_encrypt_blocks(const uchar *plain, uchar *cipher, int blocks, const quint32 *s) {
+    int i = 0;
+#ifdef WITH_SERPENT_AVX2
+    if ( serpent_has_avx2() ) {
+        for ( ; i + 8 <= blocks ; i += 8 ) {
+            serpent_encrypt_128b_avx2(plain + 16*i, cipher + 16*i, s);
+        }
+    }
+#endif
+#ifdef WITH_SERPENT_SSE2
+    for ( ; i + 4 <= blocks ; i += 4 ) {
+        serpent_encrypt_64b_sse2(plain + 16*i, cipher + 16*i, s);
+    }
+#endif
+    for ( ; i < blocks ; i++ ) {
+        serpent_encrypt_16b(plain + 16*i, cipher + 16*i, s);
+    }
+}
+
+void serpent_decrypt_blocks(const uchar *cipher, uchar *plain, int blocks, const quint32 *s) {
+    int i = 0;
+#ifdef WITH_SERPENT_AVX2
+    if ( serpent_has_avx2() ) {
+        for ( ; i + 8 <= blocks ; i += 8 ) {
+            serpent_decrypt_128b_avx2(cipher + 16*i, plain + 16*i, s);
+        }
+    }
+#endif
+#ifdef WITH_SERPENT_SSE2
+    for ( ; i + 4 <= blocks ; i += 4 ) {
+        serpent_decrypt_64b_sse2(cipher + 16*i, plain + 16*i, s);
+    }
+#endif
+    for ( ; i < blocks ; i++ ) {
+        serpent_decrypt_16b(cipher + 16*i, plain + 16*i, s);
+    }
+}
+
+
 #ifdef WITH_SERPENT_PRINT_SBOX_H
 void serpent_print_sbox_h() {
     int sbox;
@@ -53,6 +53,7 @@
 #include <QByteArray>
 #include <QSharedPointer>
 #include <QObject>
+#include <QMutex>
 
 #include "asemantools_global.h"
 
@@ -65,6 +66,7 @@ class Decryptor;
 class LayerMode;
 class CFB;
 class CBC;
+class CTR;
 
 enum Algorithm {
     NoAlgorithm = 0,
@@ -81,7 +83,8 @@ enum Mode {
     NoMode = 0,
     DetectMode,
     ModeCBC,
-    ModeCFB
+    ModeCFB,
+    ModeCTR
 };
 
 enum Checksum {
@@ -116,10 +119,21 @@ class Info {
 public:
     static Algorithm fastRC5();
     static QString errorText(Error e);
+    // plain text header in front of the data for this algorithm and mode
+    static QByteArray header(Algorithm a, Mode m);
 };
 
 
 
+class KeySchedule;
+
+/*
+ * Expanded key schedules are kept in a process wide LRU cache, keyed by
+ * the digest of the key, so every Key object with the same key shares
+ * one expansion. Schedules are wiped when the last user releases them.
+ * A Key may be shared by encryptors running on different threads, the
+ * expandKey functions serialize on a per Key mutex.
+ */
 class LIBASEMANTOOLSSHARED_EXPORT Key : public QObject {
     Q_OBJECT
 public:
@@ -135,7 +149,12 @@ public:
 #endif
     void expandKeySerpent();
 
-    // variables
+    // number of expanded keys kept in the cache, 0 disables it
+    static void setScheduleCacheSize(int keys);
+    static int scheduleCacheSize();
+    static void clearScheduleCache();
+
+    // variables, key must not change after construction
     QByteArray key;
 #ifdef WITHRC5
     QByteArray keyRc5;
@@ -146,6 +165,17 @@ public:
     quint32 *serpent;
 private:
     QByteArray resizeKey(int ks);
+    QByteArray scheduleId(Algorithm a);
+    QSharedPointer<KeySchedule> findSchedule(Algorithm a);
+    void insertSchedule(Algorithm a, QSharedPointer<KeySchedule> schedule);
+
+    QByteArray digest;
+    QMutex mutex;
+#ifdef WITHRC5
+    QSharedPointer<KeySchedule> scheduleRc532;
+    QSharedPointer<KeySchedule> scheduleRc564;
+#endif
+    QSharedPointer<KeySchedule> scheduleSerpent;
 };
 
 
@@ -180,7 +210,9 @@ private:
 
 // will attempt all different combinations, and give you a
 // Decryptor back to decrypt rest of data or more messages
-// from the same source
+// from the same source. Each combination is first checked by
+// decrypting only the first header block, and the combination
+// that worked last time is tried first.
 class DecryptorWizardEntry;
 class DecryptorWizard {
 public:
@@ -192,8 +224,22 @@ public:
 
     Error decrypt(const QByteArray &cipher, QByteArray &plain, QSharedPointer<Decryptor> &decryptor, bool end = false);
     Error decryptToEnd(const QByteArray &cipher, QByteArray &plain);
+
+    // statistics of the last decrypt call: key/algorithm/mode combinations
+    // tried, probed with one block after the size checks, and fully decrypted
+    int getCandidatesTried() const;
+    int getCandidatesProbed() const;
+    int getCandidatesDecrypted() const;
 private:
+    void init();
+
     QList<DecryptorWizardEntry*> entries;
+    int lastEntry;
+    Algorithm lastAlgorithm;
+    Mode lastMode;
+    int candidatesTried;
+    int candidatesProbed;
+    int candidatesDecrypted;
 };
 
 
@@ -206,12 +252,17 @@ public:
     Error decrypt(const QByteArray &cipher, QByteArray &plain, bool end);
     void reset();
     Checksum getChecksumType();
+
+    // see LayerMode::setParallelThreshold()
+    void setParallelThreshold(int bytes);
+    int getParallelThreshold() const;
 private:
     QSharedPointer<Key> key;
     Algorithm algorithm;
     Mode mode;
     State state;
     Checksum checksum;
+    int parallelThreshold;
     LayerMode *modex;
 };
 
@@ -221,6 +272,7 @@ class InitializationVector {
 public:
     static QByteArray getVector8();
     static QByteArray getVector16();
+    static QByteArray getNonce8();
     static void initiate();
 };
 
@@ -234,10 +286,36 @@ public:
  */
 class LayerMode {
 public:
-    virtual QByteArray encrypt(const QByteArray plain, bool end) = 0;
-    virtual QByteArray decrypt(const QByteArray cipher, bool end) = 0;
+    LayerMode();
+    virtual QByteArray encrypt(const QByteArray plain, bool end);
+    virtual QByteArray decrypt(const QByteArray cipher, bool end);
     virtual void reset() = 0;
     virtual ~LayerMode() {};
+
+    // Span versions, the QByteArray ones are built on top of them.
+    // out needs room for encryptSize(len) / decryptSize(len) bytes,
+    // the number of bytes written is returned.
+    virtual int encrypt(const uchar *plain, int len, uchar *cipher, bool end) = 0;
+    virtual int decrypt(const uchar *cipher, int len, uchar *plain, bool end) = 0;
+    virtual int encryptSize(int len) const = 0;
+    virtual int decryptSize(int len) const = 0;
+
+    // In place versions: the data starts encryptHeadroom() /
+    // decryptHeadroom() bytes into buffer and the result is written
+    // from the start of buffer, so the IV needs no extra copy.
+    // buffer needs room for encryptSize(len) / decryptSize(len) bytes.
+    virtual int encryptHeadroom() const = 0;
+    virtual int decryptHeadroom() const = 0;
+    int encryptInPlace(uchar *buffer, int len, bool end);
+    int decryptInPlace(uchar *buffer, int len, bool end);
+
+    // decrypt calls with at least this many bytes are split into
+    // segments and decrypted on QThreadPool::globalInstance(),
+    // 0 disables it
+    void setParallelThreshold(int bytes);
+    int getParallelThreshold() const;
+protected:
+    int parallelThreshold;
 };
 
 class CFB : public LayerMode {
@@ -247,6 +325,12 @@ public:
     QByteArray encrypt(const QByteArray plain, bool end = false);
     QByteArray decrypt(const QByteArray cipher, bool end = false);
     void reset();
+    int encrypt(const uchar *plain, int len, uchar *cipher, bool end);
+    int decrypt(const uchar *cipher, int len, uchar *plain, bool end);
+    int encryptSize(int len) const;
+    int decryptSize(int len) const;
+    int encryptHeadroom() const;
+    int decryptHeadroom() const;
 private:
     QByteArray buffer;
     int bufferpos;
@@ -261,6 +345,12 @@ public:
     QByteArray encrypt(const QByteArray plain, bool end);
     QByteArray decrypt(const QByteArray cipher, bool end);
     void reset();
+    int encrypt(const uchar *plain, int len, uchar *cipher, bool end);
+    int decrypt(const uchar *cipher, int len, uchar *plain, bool end);
+    int encryptSize(int len) const;
+    int decryptSize(int len) const;
+    int encryptHeadroom() const;
+    int decryptHeadroom() const;
 private:
     QByteArray buffer;
     QByteArray cbcBuffer;
@@ -271,6 +361,47 @@ private:
 };
 
 
+/*
+ * Counter mode: IV followed by data XOR keystream. The keystream at
+ * any position can be computed directly, so a stream can be
+ * decrypted from the middle with setIv() and seek(), or without
+ * any state with crypt().
+ */
+class CTR : public LayerMode {
+public:
+    CTR(QSharedPointer<Key> k, Algorithm a);
+    virtual ~CTR();
+    QByteArray encrypt(const QByteArray plain, bool end = false);
+    QByteArray decrypt(const QByteArray cipher, bool end = false);
+    void reset();
+    int encrypt(const uchar *plain, int len, uchar *cipher, bool end);
+    int decrypt(const uchar *cipher, int len, uchar *plain, bool end);
+    int encryptSize(int len) const;
+    int decryptSize(int len) const;
+    int encryptHeadroom() const;
+    int decryptHeadroom() const;
+
+    // IV of the current stream, empty until it is known
+    QByteArray getIv() const;
+    void setIv(const QByteArray &iv);
+
+    // keystream position of the next encrypt/decrypt, IV excluded
+    qint64 position() const;
+    void seek(qint64 pos);
+
+    // en/decrypts len bytes at keystream position pos, in and out may be equal
+    void crypt(const uchar *in, uchar *out, int len, qint64 pos) const;
+
+    static int blockSize(Algorithm a);
+private:
+    QByteArray iv;
+    qint64 pos;
+    int blocksize;
+    Algorithm algorithm;
+    QSharedPointer<Key> key;
+};
+
+
 /* *** Layer 1 : block layer - experts only *** */
 
 #ifdef WITHRC5
@@ -295,6 +426,11 @@ void serpent_decrypt_4w(quint32 &X1, quint32 &X2,
 void serpent_encrypt_16b(const uchar *plain16, uchar *cipher16, const quint32 *s);
 void serpent_decrypt_16b(const uchar *cipher16, uchar *plain16, const quint32 *s);
 
+// any number of consecutive 16 byte blocks (ECB), using
+// 4 or 8 blocks at once with SSE2/AVX2 when the CPU has it
+void serpent_encrypt_blocks(const uchar *plain, uchar *cipher, int blocks, const quint32 *s);
+void serpent_decrypt_blocks(const uchar *cipher, uchar *plain, int blocks, const quint32 *s);
+
 #ifdef WITH_SERPENT_PRINT_SBOX_H
 void serpent_print_sbox_h();
 #endif
@@ -19,6 +19,7 @@
 #include "asemantools.h"
 #include "asemandevices.h"
 #include "asemanqttools.h"
+#include "private/asemanimageheader.h"
 
 #include <QMetaMethod>
 #include <QMetaObject>
@@ -244,8 +245,7 @@ QSize AsemanTools::imageSize(const QString &_path)
     if(path.left(AsemanDevices::localFilesPrePath().size()) == AsemanDevices::localFilesPrePath())
         path = path.mid(AsemanDevices::localFilesPrePath().size());
 
-    QImageReader image(path);
-    return image.size();
+    return AsemanImageHeader::read(path).size();
 }
 
 bool AsemanTools::writeFile(const QString &path, const QVariant &data, bool compress)
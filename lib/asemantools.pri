@@ -163,6 +163,7 @@ SOURCES += \
     $$PWD/asemansysteminfo.cpp \
     $$PWD/asemanabstractcolorfulllistmodel.cpp \
     $$PWD/asemanimagecoloranalizor.cpp \
+    $$PWD/private/asemanimagecolorkernel.cpp \
     $$PWD/asemancountriesmodel.cpp \
     $$PWD/asemanmimedata.cpp \
     $$PWD/asemanmimeapps.cpp \
@@ -173,6 +174,10 @@ SOURCES += \
     $$PWD/asemanquickitemimagegrabber.cpp \
     $$PWD/asemanquickobject.cpp \
     $$PWD/asemanfilesystemmodel.cpp \
+    $$PWD/private/asemanabstractjob.cpp \
+    $$PWD/private/asemanfilesystemsortkeys.cpp \
+    $$PWD/private/asemanfilesystemenumerator.cpp \
+    $$PWD/private/asemanfilesystemattributes.cpp \
     $$PWD/asemandebugobjectcounter.cpp \
     $$PWD/asemanfiledownloaderqueue.cpp \
     $$PWD/asemanfiledownloaderqueueitem.cpp \
@@ -207,6 +212,8 @@ SOURCES += \
     $$PWD/asemantexttools.cpp \
     $$PWD/asemanapplicationitem.cpp \
     $$PWD/asemanencrypter.cpp \
+    $$PWD/private/asemanencrypterasyncjob.cpp \
+    $$PWD/asemanencrypteddevice.cpp \
     $$PWD/asemancontributorsmodel.cpp \
     $$PWD/qtsingleapplication/qtlockedfile.cpp \
     $$PWD/qtsingleapplication/qtlocalpeer.cpp \
@@ -215,6 +222,10 @@ SOURCES += \
     $$PWD/asemanitemgrabber.cpp \
     $$PWD/asemantranslationmanager.cpp \
     $$PWD/asemanqmlimage.cpp \
+    $$PWD/private/asemanimagedecoder.cpp \
+    $$PWD/private/asemanimagedecodestrategy.cpp \
+    $$PWD/private/asemanimageheader.cpp \
+    $$PWD/private/asemanimagecache.cpp \
     $$PWD/asemannetworkproxy.cpp
 
 HEADERS += \
@@ -233,6 +244,7 @@ HEADERS += \
     $$PWD/asemansysteminfo.h \
     $$PWD/asemanabstractcolorfulllistmodel.h \
     $$PWD/asemanimagecoloranalizor.h \
+    $$PWD/private/asemanimagecolorkernel.h \
     $$PWD/asemancountriesmodel.h \
     $$PWD/asemanmimedata.h \
     $$PWD/asemanmimeapps.h \
@@ -243,6 +255,10 @@ HEADERS += \
     $$PWD/asemanquickitemimagegrabber.h \
     $$PWD/asemanquickobject.h \
     $$PWD/asemanfilesystemmodel.h \
+    $$PWD/private/asemanabstractjob.h \
+    $$PWD/private/asemanfilesystemsortkeys.h \
+    $$PWD/private/asemanfilesystemenumerator.h \
+    $$PWD/private/asemanfilesystemattributes.h \
     $$PWD/asemandebugobjectcounter.h \
     $$PWD/asemanfiledownloaderqueue.h \
     $$PWD/asemanfiledownloaderqueueitem.h \
@@ -279,6 +295,8 @@ HEADERS += \
     $$PWD/asemantexttools.h \
     $$PWD/asemanapplicationitem.h \
     $$PWD/asemanencrypter.h \
+    $$PWD/private/asemanencrypterasyncjob.h \
+    $$PWD/asemanencrypteddevice.h \
     $$PWD/asemancontributorsmodel.h \
     $$PWD/qtsingleapplication/qtlockedfile.h \
     $$PWD/qtsingleapplication/qtlocalpeer.h \
@@ -287,6 +305,10 @@ HEADERS += \
     $$PWD/asemanitemgrabber.h \
     $$PWD/asemantranslationmanager.h \
     $$PWD/asemanqmlimage.h \
+    $$PWD/private/asemanimagedecoder.h \
+    $$PWD/private/asemanimagedecodestrategy.h \
+    $$PWD/private/asemanimageheader.h \
+    $$PWD/private/asemanimagecache.h \
     $$PWD/asemantools_global.h \
     $$PWD/asemannetworkproxy.h
 
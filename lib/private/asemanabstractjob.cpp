@@ -0,0 +1,81 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asemanabstractjob.h"
+
+#include <QThreadPool>
+#include <QCoreApplication>
+#include <QAtomicInt>
+
+class AsemanAbstractJobPrivate
+{
+public:
+    QPointer<QThreadPool> pool;
+    QAtomicInt canceled;
+};
+
+AsemanAbstractJob::AsemanAbstractJob(QThreadPool *pool) :
+    QObject()
+{
+    p = new AsemanAbstractJobPrivate;
+    p->pool = pool;
+    setAutoDelete(false);
+}
+
+/*
+ * The pool of one kind of job, made on the first use and deleted with
+ * the application.
+ */
+QThreadPool *AsemanAbstractJob::sharedPool(QPointer<QThreadPool> &pool, int maxThreadCount)
+{
+    if(pool)
+        return pool;
+
+    pool = new QThreadPool(QCoreApplication::instance());
+    pool->setMaxThreadCount( qMax(1, maxThreadCount) );
+    return pool;
+}
+
+void AsemanAbstractJob::start()
+{
+    if(p->pool)
+        p->pool->start(this);
+    else
+        deleteLater();
+}
+
+void AsemanAbstractJob::cancel()
+{
+    p->canceled.storeRelease(1);
+}
+
+bool AsemanAbstractJob::isCanceled() const
+{
+    return p->canceled.loadAcquire();
+}
+
+void AsemanAbstractJob::run()
+{
+    execute();
+    deleteLater();
+}
+
+AsemanAbstractJob::~AsemanAbstractJob()
+{
+    delete p;
+}
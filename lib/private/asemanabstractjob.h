@@ -0,0 +1,64 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANABSTRACTJOB_H
+#define ASEMANABSTRACTJOB_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QPointer>
+
+#include "asemantools_global.h"
+
+class QThreadPool;
+
+/*
+ * Base of the jobs that do the slow work of a GUI side object on a
+ * thread pool: AsemanImageDecoder, AsemanEncrypterAsyncJob,
+ * AsemanFileSystemEnumerator and AsemanFileSystemAttributesLoader.
+ * A job is created and started on the GUI thread. execute() runs on the
+ * pool and reports through signals, which reach the GUI side queued.
+ * After it the job deletes itself on the GUI thread, so a QPointer to
+ * it stays valid until its last signal is delivered. cancel() is only
+ * a flag, execute() checks isCanceled() between its steps.
+ * Every kind of job has a pool of its own, made by sharedPool(), so a
+ * slow disk or a long encryption never holds back the other ones.
+ */
+class AsemanAbstractJobPrivate;
+class LIBASEMANTOOLSSHARED_EXPORT AsemanAbstractJob : public QObject, public QRunnable
+{
+    Q_OBJECT
+public:
+    AsemanAbstractJob(QThreadPool *pool);
+    virtual ~AsemanAbstractJob();
+
+    void start();
+    void cancel();
+    bool isCanceled() const;
+
+    virtual void run();
+
+protected:
+    virtual void execute() = 0;
+    static QThreadPool *sharedPool(QPointer<QThreadPool> &pool, int maxThreadCount);
+
+private:
+    AsemanAbstractJobPrivate *p;
+};
+
+#endif // ASEMANABSTRACTJOB_H
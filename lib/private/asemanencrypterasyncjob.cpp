@@ -0,0 +1,104 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define ASYNC_CHUNK_SIZE 262144
+
+#include "asemanencrypterasyncjob.h"
+#include "../asemansysteminfo.h"
+
+#include <QThread>
+#include <QPointer>
+
+using namespace AsemanSimpleQtCryptor;
+
+static QPointer<QThreadPool> aseman_encrypter_async_pool;
+
+AsemanEncrypterAsyncJob::AsemanEncrypterAsyncJob(int id, QSharedPointer<Key> key, const QByteArray &data, bool decrypt) :
+    AsemanAbstractJob(pool()),
+    _id(id),
+    _key(key),
+    _data(data),
+    _decrypt(decrypt)
+{
+}
+
+/*
+ * The jobs run on a pool of their own, sized from the cpu cores, so
+ * long encryptions never hold back the global pool that the parallel
+ * decryptor and batch functions use.
+ */
+QThreadPool *AsemanEncrypterAsyncJob::pool()
+{
+    if(aseman_encrypter_async_pool)
+        return aseman_encrypter_async_pool;
+
+    int threads = (int)AsemanSystemInfo().cpuCores();
+    if(threads <= 0)
+        threads = QThread::idealThreadCount();
+
+    return sharedPool(aseman_encrypter_async_pool, threads);
+}
+
+/*
+ * Same output as AsemanEncrypter::encrypt/decrypt, made ASYNC_CHUNK_SIZE
+ * bytes at a time so it can report progress and stop between chunks.
+ */
+void AsemanEncrypterAsyncJob::execute()
+{
+    Encryptor enc(_key, SERPENT_32, ModeCFB, NoChecksum);
+    Decryptor dec(_key, SERPENT_32, ModeCFB);
+
+    QByteArray result;
+    result.reserve(_data.size() + 64);
+
+    Error err = NoError;
+    const int size = _data.size();
+    int done = 0;
+    do
+    {
+        if(isCanceled())
+            break;
+
+        const int len = qMin(ASYNC_CHUNK_SIZE, size - done);
+        const bool end = (done + len == size);
+        const QByteArray chunk = QByteArray::fromRawData(_data.constData() + done, len);
+
+        QByteArray out;
+        err = _decrypt? dec.decrypt(chunk, out, end) : enc.encrypt(chunk, out, end);
+        if(err != NoError)
+            break;
+
+        result.append(out);
+        done += len;
+        Q_EMIT progress(_id, size? qreal(done)/size : 1);
+    } while(done < size);
+
+    if(isCanceled())
+        Q_EMIT canceled(_id);
+    else
+    if(err != NoError)
+        Q_EMIT finished(_id, _decrypt? QByteArray() : _data);
+    else
+        Q_EMIT finished(_id, result);
+
+    _data.clear();
+}
+
+AsemanEncrypterAsyncJob::~AsemanEncrypterAsyncJob()
+{
+}
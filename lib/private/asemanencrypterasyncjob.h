@@ -0,0 +1,58 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANENCRYPTERASYNCJOB_H
+#define ASEMANENCRYPTERASYNCJOB_H
+
+#include <QSharedPointer>
+#include <QByteArray>
+
+#include "asemansimpleqtcryptor.h"
+#include "asemanabstractjob.h"
+
+class QThreadPool;
+
+/*
+ * Runs one encryptAsync/decryptAsync call of AsemanEncrypter on the
+ * encrypter pool.
+ */
+class AsemanEncrypterAsyncJob : public AsemanAbstractJob
+{
+    Q_OBJECT
+public:
+    AsemanEncrypterAsyncJob(int id, QSharedPointer<AsemanSimpleQtCryptor::Key> key, const QByteArray &data, bool decrypt);
+    virtual ~AsemanEncrypterAsyncJob();
+
+    static QThreadPool *pool();
+
+Q_SIGNALS:
+    void progress(int job, qreal progress);
+    void finished(int job, const QByteArray &result);
+    void canceled(int job);
+
+protected:
+    virtual void execute();
+
+private:
+    int _id;
+    QSharedPointer<AsemanSimpleQtCryptor::Key> _key;
+    QByteArray _data;
+    bool _decrypt;
+};
+
+#endif // ASEMANENCRYPTERASYNCJOB_H
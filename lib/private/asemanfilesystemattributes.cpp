@@ -0,0 +1,121 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define POOL_THREADS 2
+
+#include "asemanfilesystemattributes.h"
+
+#include <QMimeDatabase>
+#include <QFileInfo>
+#include <QPointer>
+
+static QPointer<QThreadPool> aseman_filesystem_attributes_pool;
+
+class AsemanFileSystemAttributesLoaderPrivate
+{
+public:
+    QStringList paths;
+};
+
+AsemanFileSystemAttributesLoader::AsemanFileSystemAttributesLoader(const QStringList &paths) :
+    AsemanAbstractJob(pool())
+{
+    qRegisterMetaType< QList<AsemanFileSystemAttributes> >("QList<AsemanFileSystemAttributes>");
+
+    p = new AsemanFileSystemAttributesLoaderPrivate;
+    p->paths = paths;
+}
+
+/*
+ * The mime type by the file name only, without touching the disk.
+ */
+QString AsemanFileSystemAttributesLoader::mimeByName(const QString &fileName, bool isDir)
+{
+    if(isDir)
+        return "inode/directory";
+
+    QMimeDatabase mdb;
+    const QList<QMimeType> &types = mdb.mimeTypesForFileName(fileName);
+    if(types.isEmpty())
+        return "application/octet-stream";
+
+    return types.first().name();
+}
+
+/*
+ * Separated from the AsemanFileSystemEnumerator pool, so stats stuck on
+ * a dead mount never hold back the listings.
+ */
+QThreadPool *AsemanFileSystemAttributesLoader::pool()
+{
+    return sharedPool(aseman_filesystem_attributes_pool, POOL_THREADS);
+}
+
+void AsemanFileSystemAttributesLoader::execute()
+{
+    QMimeDatabase mdb;
+    QList<AsemanFileSystemAttributes> list;
+    QList<int> unknown;
+    for(const QString &path: p->paths)
+    {
+        if(isCanceled())
+            break;
+
+        const QFileInfo info(path);
+        AsemanFileSystemAttributes attr;
+        attr.path = path;
+        attr.size = info.size();
+        attr.modified = info.lastModified();
+        attr.created = info.created();
+
+        const QList<QMimeType> &types = info.isDir()? QList<QMimeType>() : mdb.mimeTypesForFileName(info.fileName());
+        if(info.isDir())
+            attr.mime = "inode/directory";
+        else
+            attr.mime = types.isEmpty()? QString("application/octet-stream") : types.first().name();
+        attr.sniffed = (info.isDir() || types.count() == 1);
+        if(!attr.sniffed)
+            unknown << list.count();
+
+        list << attr;
+    }
+
+    if(!isCanceled() && !list.isEmpty())
+        Q_EMIT loaded(list);
+
+    // Reading the content is the slow part, so it comes last
+    QList<AsemanFileSystemAttributes> sniffed;
+    for(int idx: unknown)
+    {
+        if(isCanceled())
+            break;
+
+        AsemanFileSystemAttributes attr = list.at(idx);
+        attr.mime = mdb.mimeTypeForFile(attr.path).name();
+        attr.sniffed = true;
+        sniffed << attr;
+    }
+
+    if(!isCanceled() && !sniffed.isEmpty())
+        Q_EMIT loaded(sniffed);
+}
+
+AsemanFileSystemAttributesLoader::~AsemanFileSystemAttributesLoader()
+{
+    delete p;
+}
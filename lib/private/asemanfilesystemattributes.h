@@ -0,0 +1,77 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANFILESYSTEMATTRIBUTES_H
+#define ASEMANFILESYSTEMATTRIBUTES_H
+
+#include <QDateTime>
+#include <QStringList>
+#include <QMetaType>
+
+#include "asemantools_global.h"
+#include "asemanabstractjob.h"
+
+class QThreadPool;
+
+/*
+ * The attributes of a file that need I/O: a stat for the size and the
+ * dates, and maybe the file content for the mime type.
+ */
+class AsemanFileSystemAttributes
+{
+public:
+    AsemanFileSystemAttributes(): size(0), sniffed(false) {}
+
+    QString path;
+    qint64 size;
+    QDateTime modified;
+    QDateTime created;
+    QString mime;
+    bool sniffed;
+};
+
+/*
+ * Loads the attributes of some files on a pool of its own. Every file
+ * is stated and gets its mime type by its name first, and loaded()
+ * reports them. Then the files their name does not tell the type of
+ * are sniffed by content and reported again.
+ */
+class AsemanFileSystemAttributesLoaderPrivate;
+class LIBASEMANTOOLSSHARED_EXPORT AsemanFileSystemAttributesLoader : public AsemanAbstractJob
+{
+    Q_OBJECT
+public:
+    AsemanFileSystemAttributesLoader(const QStringList &paths);
+    virtual ~AsemanFileSystemAttributesLoader();
+
+    static QString mimeByName(const QString &fileName, bool isDir);
+    static QThreadPool *pool();
+
+Q_SIGNALS:
+    void loaded(const QList<AsemanFileSystemAttributes> &list);
+
+protected:
+    virtual void execute();
+
+private:
+    AsemanFileSystemAttributesLoaderPrivate *p;
+};
+
+Q_DECLARE_METATYPE(QList<AsemanFileSystemAttributes>)
+
+#endif // ASEMANFILESYSTEMATTRIBUTES_H
@@ -0,0 +1,259 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define POOL_THREADS 4
+#define BATCH_SIZE 512
+#define BATCH_INTERVAL 100
+
+#include "asemanfilesystemenumerator.h"
+#include "asemanfilesystemsortkeys.h"
+#include "../asemanfilesystemmodel.h"
+
+#include <QDirIterator>
+#include <QMimeDatabase>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QDateTime>
+
+static QPointer<QThreadPool> aseman_filesystem_enumerator_pool;
+
+class AsemanFileSystemEnumeratorPrivate
+{
+public:
+    QString folder;
+    int filters;
+    QStringList nameFilters;
+    int sortField;
+    bool dirsFirst;
+    bool batches;
+    bool listed;
+    QList<QFileInfo> list;
+    QHash<QString, AsemanFileSystemAttributes> attributes;
+    QMimeDatabase mdb;
+};
+
+AsemanFileSystemEnumerator::AsemanFileSystemEnumerator(const QString &folder, int filters, const QStringList &nameFilters,
+                                                       int sortField, bool dirsFirst, bool batches) :
+    AsemanAbstractJob(pool())
+{
+    qRegisterMetaType< QList<QFileInfo> >("QList<QFileInfo>");
+
+    p = new AsemanFileSystemEnumeratorPrivate;
+    p->folder = folder;
+    p->filters = filters;
+    p->nameFilters = nameFilters;
+    p->sortField = sortField;
+    p->dirsFirst = dirsFirst;
+    p->batches = batches;
+    p->listed = false;
+}
+
+AsemanFileSystemEnumerator::AsemanFileSystemEnumerator(const QList<QFileInfo> &list, const QHash<QString, AsemanFileSystemAttributes> &attributes,
+                                                       int sortField, bool dirsFirst) :
+    AsemanAbstractJob(pool())
+{
+    qRegisterMetaType< QList<QFileInfo> >("QList<QFileInfo>");
+
+    p = new AsemanFileSystemEnumeratorPrivate;
+    p->filters = 0;
+    p->sortField = sortField;
+    p->dirsFirst = dirsFirst;
+    p->batches = false;
+    p->listed = true;
+    p->list = list;
+    p->attributes = attributes;
+}
+
+QThreadPool *AsemanFileSystemEnumerator::pool()
+{
+    return sharedPool(aseman_filesystem_enumerator_pool, POOL_THREADS);
+}
+
+void AsemanFileSystemEnumerator::execute()
+{
+    const bool primed = !p->listed;
+    if(!p->listed)
+        enumerate();
+
+    if(!isCanceled())
+    {
+        const QList<QFileInfo> &sorted = sort(p->list, p->attributes, p->sortField, p->dirsFirst, primed);
+        if(!isCanceled())
+            Q_EMIT finished(sorted);
+    }
+}
+
+/*
+ * Extracts one key per entry and sorts by them. The entries may be
+ * shared with the GUI thread, whose QFileInfo copies fill the same
+ * metadata cache, so only what enumerate() already filled is read from
+ * them: the dir flag, and the sort field when primed is set. Otherwise
+ * the size and dates come from the loaded attributes, and only the
+ * entries without them are stated with new QFileInfos.
+ */
+QList<QFileInfo> AsemanFileSystemEnumerator::sort(const QList<QFileInfo> &list, const QHash<QString, AsemanFileSystemAttributes> &attributes,
+                                                  int sortField, bool dirsFirst, bool primed)
+{
+    AsemanFileSystemSortKeys keys;
+    keys.reserve(list.count());
+    for(const QFileInfo &entry: list)
+    {
+        const QString &fileName = entry.fileName();
+        const bool isDir = entry.isDir();
+
+        AsemanFileSystemAttributes attr;
+        switch(sortField)
+        {
+        case AsemanFileSystemModel::Size:
+        case AsemanFileSystemModel::Date:
+        case AsemanFileSystemModel::CreatedDate:
+            if(primed)
+            {
+                if(sortField == AsemanFileSystemModel::Size)
+                    attr.size = entry.size();
+                else if(sortField == AsemanFileSystemModel::Date)
+                    attr.modified = entry.lastModified();
+                else
+                    attr.created = entry.created();
+            }
+            else
+            {
+                QHash<QString, AsemanFileSystemAttributes>::const_iterator i = attributes.constFind(entry.filePath());
+                if(i != attributes.constEnd())
+                    attr = i.value();
+                else
+                {
+                    const QFileInfo info(entry.filePath());
+                    attr.size = info.size();
+                    attr.modified = info.lastModified();
+                    attr.created = info.created();
+                }
+            }
+            break;
+        }
+
+        switch(sortField)
+        {
+        case AsemanFileSystemModel::Size:
+            keys.append(fileName, isDir, dirsFirst, quint64(qMax<qint64>(attr.size, 0)));
+            break;
+
+        case AsemanFileSystemModel::Date:
+            keys.append(fileName, isDir, dirsFirst, dateKey(attr.modified));
+            break;
+
+        case AsemanFileSystemModel::CreatedDate:
+            keys.append(fileName, isDir, dirsFirst, dateKey(attr.created));
+            break;
+
+        case AsemanFileSystemModel::Type:
+            keys.append(fileName, isDir, dirsFirst, isDir? QString() : entry.suffix().toLower());
+            break;
+
+        default:
+            keys.append(fileName, isDir, dirsFirst);
+            break;
+        }
+    }
+
+    QList<QFileInfo> sorted;
+    sorted.reserve(list.count());
+    for(int idx: keys.sortedIndexes())
+        sorted << list.at(idx);
+
+    return sorted;
+}
+
+void AsemanFileSystemEnumerator::enumerate()
+{
+    if(!p->filters || p->folder.isEmpty())
+        return;
+
+    QDirIterator it(p->folder, static_cast<QDir::Filters>(p->filters));
+
+    QElapsedTimer timer;
+    timer.start();
+    int published = 0;
+    while(it.hasNext() && !isCanceled())
+    {
+        it.next();
+        const QFileInfo &info = it.fileInfo();
+        if(!accept(info))
+            continue;
+
+        // Filled before the entry is shared, sort() reads them later
+        info.isDir();
+        switch(p->sortField)
+        {
+        case AsemanFileSystemModel::Size:
+            info.size();
+            break;
+        case AsemanFileSystemModel::Date:
+            info.lastModified();
+            break;
+        case AsemanFileSystemModel::CreatedDate:
+            info.created();
+            break;
+        }
+
+        p->list << info;
+        if(!p->batches)
+            continue;
+        if(p->list.count() - published < BATCH_SIZE && timer.elapsed() < BATCH_INTERVAL)
+            continue;
+
+        Q_EMIT batch(p->list.mid(published));
+        published = p->list.count();
+        timer.restart();
+    }
+}
+
+/*
+ * Milliseconds since the epoch, moved to unsigned so dates before 1970
+ * come first. Invalid dates sort as the oldest.
+ */
+quint64 AsemanFileSystemEnumerator::dateKey(const QDateTime &date)
+{
+    if(!date.isValid())
+        return 0;
+
+    return quint64(date.toMSecsSinceEpoch()) ^ Q_UINT64_C(0x8000000000000000);
+}
+
+bool AsemanFileSystemEnumerator::accept(const QFileInfo &info)
+{
+    if(p->nameFilters.isEmpty() || info.isDir())
+        return true;
+
+    QStringList suffixes;
+    if(!info.suffix().isEmpty())
+        suffixes << info.suffix();
+    else
+        suffixes = p->mdb.mimeTypeForFile(info.filePath()).suffixes();
+
+    for(const QString &sfx: suffixes)
+        if(p->nameFilters.contains("*."+sfx, Qt::CaseInsensitive))
+            return true;
+
+    return false;
+}
+
+AsemanFileSystemEnumerator::~AsemanFileSystemEnumerator()
+{
+    delete p;
+}
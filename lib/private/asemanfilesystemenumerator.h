@@ -0,0 +1,78 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANFILESYSTEMENUMERATOR_H
+#define ASEMANFILESYSTEMENUMERATOR_H
+
+#include <QFileInfo>
+#include <QStringList>
+#include <QMetaType>
+#include <QDateTime>
+#include <QHash>
+
+#include "asemantools_global.h"
+#include "asemanfilesystemattributes.h"
+#include "asemanabstractjob.h"
+
+class QThreadPool;
+
+/*
+ * Lists, filters and sorts one folder of AsemanFileSystemModel on the
+ * file system pool, so slow disks and network mounts do not block the
+ * GUI thread. Entries come from QDirIterator, which takes the file type
+ * from readdir and only calls stat when it has to.
+ * With batches set, the entries found so far are published unsorted
+ * every BATCH_SIZE entries or BATCH_INTERVAL ms. finished() gives the
+ * whole list sorted by an AsemanFileSystemModel::SortFlag. Made with a
+ * list, it only sorts that list again, with the sizes and dates of the
+ * already loaded attributes. A canceled one stops at the next entry.
+ */
+class AsemanFileSystemEnumeratorPrivate;
+class LIBASEMANTOOLSSHARED_EXPORT AsemanFileSystemEnumerator : public AsemanAbstractJob
+{
+    Q_OBJECT
+public:
+    AsemanFileSystemEnumerator(const QString &folder, int filters, const QStringList &nameFilters,
+                               int sortField, bool dirsFirst, bool batches);
+    AsemanFileSystemEnumerator(const QList<QFileInfo> &list, const QHash<QString, AsemanFileSystemAttributes> &attributes,
+                               int sortField, bool dirsFirst);
+    virtual ~AsemanFileSystemEnumerator();
+
+    static QThreadPool *pool();
+    static QList<QFileInfo> sort(const QList<QFileInfo> &list, const QHash<QString, AsemanFileSystemAttributes> &attributes,
+                                 int sortField, bool dirsFirst, bool primed);
+
+Q_SIGNALS:
+    void batch(const QList<QFileInfo> &list);
+    void finished(const QList<QFileInfo> &list);
+
+protected:
+    virtual void execute();
+
+private:
+    bool accept(const QFileInfo &info);
+    void enumerate();
+    static quint64 dateKey(const QDateTime &date);
+
+private:
+    AsemanFileSystemEnumeratorPrivate *p;
+};
+
+Q_DECLARE_METATYPE(QList<QFileInfo>)
+
+#endif // ASEMANFILESYSTEMENUMERATOR_H
@@ -0,0 +1,156 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asemanfilesystemsortkeys.h"
+
+#include <QtAlgorithms>
+
+AsemanFileSystemSortKeys::AsemanFileSystemSortKeys()
+{
+    _offsets << 0;
+}
+
+void AsemanFileSystemSortKeys::reserve(int count, int averageLength)
+{
+    _words.reserve(count*(2*averageLength+1));
+    _offsets.reserve(count+1);
+    _ties.reserve(count);
+}
+
+void AsemanFileSystemSortKeys::append(const QString &fileName, bool isDir, bool dirsFirst)
+{
+    _words << ((dirsFirst && isDir)? 0 : 1);
+    appendName(fileName);
+}
+
+void AsemanFileSystemSortKeys::append(const QString &fileName, bool isDir, bool dirsFirst, quint64 field)
+{
+    _words << ((dirsFirst && isDir)? 0 : 1) << field;
+    appendName(fileName);
+}
+
+void AsemanFileSystemSortKeys::append(const QString &fileName, bool isDir, bool dirsFirst, const QString &field)
+{
+    _words << ((dirsFirst && isDir)? 0 : 1);
+
+    const QChar *data = field.constData();
+    for(int i=0; i<field.length(); i++)
+        _words << quint64(data[i].unicode()) + 1;
+
+    _words << 0;
+    appendName(fileName);
+}
+
+void AsemanFileSystemSortKeys::appendName(const QString &fileName)
+{
+    const QChar *data = fileName.constData();
+    const int length = fileName.length();
+    bool inNumber = false;
+    for(int i=0; i<length; i++)
+    {
+        const ushort ch = data[i].unicode();
+        int digit = -1;
+        if(ch < 128)
+        {
+            if(ch >= '0' && ch <= '9')
+                digit = ch - '0';
+        }
+        else
+        if(data[i].isNumber())
+            digit = qMax(data[i].digitValue(), 0);
+
+        if(digit < 0)
+        {
+            _words << quint64(ch) + 1;
+            inNumber = false;
+            continue;
+        }
+
+        if(!inNumber)
+        {
+            _words << 0 << 0;
+            inNumber = true;
+        }
+
+        quint64 &num = _words.last();
+        num = num*10 + digit;
+    }
+
+    // The raw name, only compared when the natural keys are equal
+    _ties << _words.size();
+    for(int i=0; i<length; i++)
+        _words << data[i].unicode();
+
+    _offsets << _words.size();
+}
+
+void AsemanFileSystemSortKeys::clear()
+{
+    _words.clear();
+    _offsets.clear();
+    _ties.clear();
+    _offsets << 0;
+}
+
+int AsemanFileSystemSortKeys::count() const
+{
+    return _offsets.size() - 1;
+}
+
+bool AsemanFileSystemSortKeys::lessThan(int a, int b) const
+{
+    const quint64 *words = _words.constData();
+    const int res = compare(words + _offsets.at(a), words + _ties.at(a),
+                            words + _offsets.at(b), words + _ties.at(b));
+    if(res)
+        return res < 0;
+
+    return compare(words + _ties.at(a), words + _offsets.at(a+1),
+                   words + _ties.at(b), words + _offsets.at(b+1)) < 0;
+}
+
+/*
+ * Lexicographic compare of two word ranges, a shorter range first.
+ */
+int AsemanFileSystemSortKeys::compare(const quint64 *i1, const quint64 *e1, const quint64 *i2, const quint64 *e2)
+{
+    for(; i1 != e1 && i2 != e2; ++i1, ++i2)
+        if(*i1 != *i2)
+            return (*i1 < *i2)? -1 : 1;
+
+    if(i1 == e1)
+        return (i2 == e2)? 0 : -1;
+
+    return 1;
+}
+
+/*
+ * Entry indexes in sorted order. Equal keys keep their order.
+ */
+QVector<int> AsemanFileSystemSortKeys::sortedIndexes() const
+{
+    QVector<int> indexes(count());
+    for(int i=0; i<indexes.size(); i++)
+        indexes[i] = i;
+
+    qStableSort(indexes.begin(), indexes.end(), [this](int a, int b){
+        return lessThan(a, b);
+    });
+
+    return indexes;
+}
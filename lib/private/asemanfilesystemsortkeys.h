@@ -0,0 +1,67 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANFILESYSTEMSORTKEYS_H
+#define ASEMANFILESYSTEMSORTKEYS_H
+
+#include <QVector>
+#include <QString>
+
+#include "asemantools_global.h"
+
+/*
+ * Natural sort keys of file names, made once per entry so sorting
+ * compares flat word ranges and does not allocate.
+ * A key is a run of 64 bit words in one shared buffer:
+ *  - the dir flag, 0 for dirs when dirs come first, otherwise 1,
+ *  - every character as 1 + its UTF-16 value,
+ *  - every digit run as a 0 word followed by its value,
+ * so a plain lexicographic compare puts numbers before characters,
+ * orders digit runs by value and a shorter name before its extensions.
+ * A sort field goes between the dir flag and the name: a number as one
+ * word, or a text as its characters and a 0 word.
+ * Names with equal natural keys, like "a01" and "a1", are ordered by
+ * their raw characters after it, so the order never depends on the
+ * order the file system lists them in.
+ */
+class LIBASEMANTOOLSSHARED_EXPORT AsemanFileSystemSortKeys
+{
+public:
+    AsemanFileSystemSortKeys();
+
+    void reserve(int count, int averageLength = 16);
+    void append(const QString &fileName, bool isDir, bool dirsFirst);
+    void append(const QString &fileName, bool isDir, bool dirsFirst, quint64 field);
+    void append(const QString &fileName, bool isDir, bool dirsFirst, const QString &field);
+    void clear();
+    int count() const;
+
+    bool lessThan(int a, int b) const;
+    QVector<int> sortedIndexes() const;
+
+private:
+    void appendName(const QString &fileName);
+    static int compare(const quint64 *i1, const quint64 *e1, const quint64 *i2, const quint64 *e2);
+
+private:
+    QVector<quint64> _words;
+    QVector<int> _offsets;
+    QVector<int> _ties;
+};
+
+#endif // ASEMANFILESYSTEMSORTKEYS_H
@@ -0,0 +1,180 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define DEFAULT_MAX_BYTES 67108864
+#define COST_UNIT 1024
+
+#include "asemanimagecache.h"
+
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QGuiApplication>
+#include <QThread>
+
+class AsemanImageCachePrivate
+{
+public:
+    AsemanImageCachePrivate() : hits(0), misses(0), watching(false) {
+        images.setMaxCost(DEFAULT_MAX_BYTES/COST_UNIT);
+    }
+
+    QMutex mutex;
+    QCache<QString, QImage> images;
+    qint64 hits;
+    qint64 misses;
+    bool watching;
+};
+
+static AsemanImageCachePrivate *aseman_image_cache()
+{
+    static AsemanImageCachePrivate *cache = new AsemanImageCachePrivate;
+    return cache;
+}
+
+static qint64 aseman_image_cache_bytes(const QImage &image)
+{
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 10, 0))
+    return image.sizeInBytes();
+#else
+    return image.byteCount();
+#endif
+}
+
+QString AsemanImageCache::key(const QString &path, const QSize &scaledSize, bool autoTransform)
+{
+    const QFileInfo info(path);
+    return QString("%1|%2|%3x%4|%5").arg(path).arg(info.lastModified().toMSecsSinceEpoch())
+            .arg(scaledSize.width()).arg(scaledSize.height()).arg(autoTransform? 1 : 0);
+}
+
+QImage AsemanImageCache::find(const QString &key, bool countMiss)
+{
+    AsemanImageCachePrivate *cache = aseman_image_cache();
+    QMutexLocker locker(&cache->mutex);
+    QImage *image = cache->images.object(key);
+    if(!image)
+    {
+        if(countMiss)
+            cache->misses++;
+        return QImage();
+    }
+
+    cache->hits++;
+    return *image;
+}
+
+void AsemanImageCache::insert(const QString &key, const QImage &image)
+{
+    if(image.isNull())
+        return;
+
+    AsemanImageCachePrivate *cache = aseman_image_cache();
+    QMutexLocker locker(&cache->mutex);
+    const int cost = aseman_image_cache_bytes(image)/COST_UNIT + 1;
+    cache->images.insert(key, new QImage(image), cost);
+}
+
+/*
+ * Frees most of the cache when the application leaves the screen, as
+ * that is when mobile systems start killing the processes using the
+ * most memory. Images are inserted from decoder and render threads, so
+ * the users of the cache call this once from the GUI thread.
+ */
+void AsemanImageCache::watchApplicationState()
+{
+    QGuiApplication *app = qobject_cast<QGuiApplication*>(QCoreApplication::instance());
+    if(!app || QThread::currentThread() != app->thread())
+        return;
+
+    AsemanImageCachePrivate *cache = aseman_image_cache();
+    QMutexLocker locker(&cache->mutex);
+    if(cache->watching)
+        return;
+
+    cache->watching = true;
+    QObject::connect(app, &QGuiApplication::applicationStateChanged, app, [](Qt::ApplicationState state){
+        if(state == Qt::ApplicationHidden || state == Qt::ApplicationSuspended)
+            AsemanImageCache::trim(AsemanImageCache::maxBytes()/4);
+    });
+}
+
+void AsemanImageCache::setMaxBytes(qint64 bytes)
+{
+    AsemanImageCachePrivate *cache = aseman_image_cache();
+    QMutexLocker locker(&cache->mutex);
+    cache->images.setMaxCost(qMax<qint64>(bytes/COST_UNIT, 0));
+}
+
+qint64 AsemanImageCache::maxBytes()
+{
+    AsemanImageCachePrivate *cache = aseman_image_cache();
+    QMutexLocker locker(&cache->mutex);
+    return (qint64)cache->images.maxCost()*COST_UNIT;
+}
+
+qint64 AsemanImageCache::bytes()
+{
+    AsemanImageCachePrivate *cache = aseman_image_cache();
+    QMutexLocker locker(&cache->mutex);
+    return (qint64)cache->images.totalCost()*COST_UNIT;
+}
+
+qint64 AsemanImageCache::hits()
+{
+    AsemanImageCachePrivate *cache = aseman_image_cache();
+    QMutexLocker locker(&cache->mutex);
+    return cache->hits;
+}
+
+qint64 AsemanImageCache::misses()
+{
+    AsemanImageCachePrivate *cache = aseman_image_cache();
+    QMutexLocker locker(&cache->mutex);
+    return cache->misses;
+}
+
+void AsemanImageCache::resetStatistics()
+{
+    AsemanImageCachePrivate *cache = aseman_image_cache();
+    QMutexLocker locker(&cache->mutex);
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+/*
+ * Drops the least recently used images until at most bytes are kept.
+ * QCache trims itself when its max cost shrinks.
+ */
+void AsemanImageCache::trim(qint64 bytes)
+{
+    AsemanImageCachePrivate *cache = aseman_image_cache();
+    QMutexLocker locker(&cache->mutex);
+    const int maxCost = cache->images.maxCost();
+    cache->images.setMaxCost(qMax<qint64>(bytes/COST_UNIT, 0));
+    cache->images.setMaxCost(maxCost);
+}
+
+void AsemanImageCache::clear()
+{
+    AsemanImageCachePrivate *cache = aseman_image_cache();
+    QMutexLocker locker(&cache->mutex);
+    cache->images.clear();
+}
@@ -0,0 +1,57 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANIMAGECACHE_H
+#define ASEMANIMAGECACHE_H
+
+#include <QImage>
+#include <QString>
+#include <QSize>
+
+#include "asemantools_global.h"
+
+/*
+ * Process wide LRU of decoded images, shared by every AsemanQmlImage
+ * that has its cache property set. Images are keyed by the file path,
+ * its modification time, the decoded size and the transform flags, and
+ * the cache is bounded by the bytes of the images it keeps. It is
+ * trimmed when the application is hidden or suspended. Thread safe.
+ */
+class LIBASEMANTOOLSSHARED_EXPORT AsemanImageCache
+{
+public:
+    static QString key(const QString &path, const QSize &scaledSize, bool autoTransform);
+
+    static QImage find(const QString &key, bool countMiss = true);
+    static void insert(const QString &key, const QImage &image);
+
+    static void watchApplicationState();
+
+    static void setMaxBytes(qint64 bytes);
+    static qint64 maxBytes();
+    static qint64 bytes();
+
+    static qint64 hits();
+    static qint64 misses();
+    static void resetStatistics();
+
+    static void trim(qint64 bytes);
+    static void clear();
+};
+
+#endif // ASEMANIMAGECACHE_H
@@ -0,0 +1,223 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asemanimagecolorkernel.h"
+#include "../asemanimagecoloranalizor.h"
+
+#include <QVector>
+
+#include <algorithm>
+#include <functional>
+
+#define PALETTE_BITS 4
+#define PALETTE_MIN_DISTANCE 48
+
+/*
+ * Same result as walking the image with QImage::pixel() and QColor:
+ *  - Normal keeps the pixels with 70 <= (r+g+b)/3 <= 180.
+ *  - MoreSaturation keeps the pixels with QColor::saturation() >= 150
+ *    and QColor::lightness() >= 50. Both are rounded to 16 bits and
+ *    then shifted to 8 bits by QColor, which gives
+ *      saturation >= 150  <=>  131070*(max-min) >= 76799*max
+ *      lightness >= 50    <=>  max+min >= 100
+ */
+QColor AsemanImageColorKernel::average(const QImage &image, int method)
+{
+    if( image.isNull() )
+        return QColor();
+
+    const QImage & img = toArgb32(image);
+
+    quint64 sum_r = 0;
+    quint64 sum_g = 0;
+    quint64 sum_b = 0;
+    quint64 count = 0;
+
+    const int width = img.width();
+    const int height = img.height();
+    for( int j=0; j<height; j++ )
+    {
+        // r, g, b, count of one row. 32 bits are enough for 16M pixels.
+        quint32 sums[4] = {0, 0, 0, 0};
+        const QRgb *line = reinterpret_cast<const QRgb*>(img.constScanLine(j));
+        switch( method )
+        {
+        case AsemanImageColorAnalizor::MoreSaturation:
+            sumMoreSaturation(line, width, sums);
+            break;
+        case AsemanImageColorAnalizor::Normal:
+        default:
+            sumNormal(line, width, sums);
+            break;
+        }
+
+        sum_r += sums[0];
+        sum_g += sums[1];
+        sum_b += sums[2];
+        count += sums[3];
+    }
+
+    if( !count )
+        return QColor();
+
+    return QColor( sum_r/count, sum_g/count, sum_b/count );
+}
+
+/*
+ * Dominant colors by a histogram of PALETTE_BITS bits per channel,
+ * made in one pass over the rows. The fullest bins are taken first,
+ * and bins too close to an already taken color are skipped, so the
+ * result is not several shades of one color. Every color is the mean
+ * of the pixels in its bin. Mostly transparent pixels are ignored.
+ */
+QList<QColor> AsemanImageColorKernel::palette(const QImage &image, int count)
+{
+    QList<QColor> result;
+    if( image.isNull() || count <= 0 )
+        return result;
+
+    const QImage & img = toArgb32(image);
+    const bool alpha = img.hasAlphaChannel();
+    const int shift = 8 - PALETTE_BITS;
+    const int bins = 1 << (3*PALETTE_BITS);
+
+    // per bin: pixels, sum of r, sum of g, sum of b
+    QVector<quint64> histogram(bins*4, 0);
+    quint64 *hist = histogram.data();
+
+    const int width = img.width();
+    const int height = img.height();
+    for( int j=0; j<height; j++ )
+    {
+        const QRgb *line = reinterpret_cast<const QRgb*>(img.constScanLine(j));
+        for( int i=0; i<width; i++ )
+        {
+            const quint32 px = line[i];
+            if( alpha && (px >> 24) < 128 )
+                continue;
+
+            const quint32 r = (px >> 16) & 0xff;
+            const quint32 g = (px >> 8) & 0xff;
+            const quint32 b = px & 0xff;
+            quint64 *bin = hist + 4*(((r >> shift) << (2*PALETTE_BITS)) | ((g >> shift) << PALETTE_BITS) | (b >> shift));
+            bin[0]++;
+            bin[1] += r;
+            bin[2] += g;
+            bin[3] += b;
+        }
+    }
+
+    QList< QPair<quint64,int> > order;
+    for( int i=0; i<bins; i++ )
+        if( hist[4*i] )
+            order << QPair<quint64,int>(hist[4*i], i);
+
+    std::sort(order.begin(), order.end(), std::greater< QPair<quint64,int> >());
+
+    for( const QPair<quint64,int> &item: order )
+    {
+        const quint64 *bin = hist + 4*item.second;
+        const QColor color( bin[1]/bin[0], bin[2]/bin[0], bin[3]/bin[0] );
+
+        bool distinct = true;
+        for( const QColor &c: result )
+        {
+            const int dr = c.red() - color.red();
+            const int dg = c.green() - color.green();
+            const int db = c.blue() - color.blue();
+            if( dr*dr + dg*dg + db*db < PALETTE_MIN_DISTANCE*PALETTE_MIN_DISTANCE )
+            {
+                distinct = false;
+                break;
+            }
+        }
+
+        if( !distinct )
+            continue;
+
+        result << color;
+        if( result.count() == count )
+            break;
+    }
+
+    return result;
+}
+
+QImage AsemanImageColorKernel::toArgb32(const QImage &image)
+{
+    if( image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32 )
+        return image;
+
+    return image.convertToFormat(QImage::Format_ARGB32);
+}
+
+void AsemanImageColorKernel::sumNormal(const QRgb *line, int width, quint32 *sums)
+{
+    quint32 sum_r = 0;
+    quint32 sum_g = 0;
+    quint32 sum_b = 0;
+    quint32 count = 0;
+    for( int i=0; i<width; i++ )
+    {
+        const quint32 px = line[i];
+        const quint32 r = (px >> 16) & 0xff;
+        const quint32 g = (px >> 8) & 0xff;
+        const quint32 b = px & 0xff;
+
+        // 210 <= r+g+b <= 542, with one unsigned compare
+        const quint32 mask = 0u - quint32(r + g + b - 210 <= 332);
+        sum_r += r & mask;
+        sum_g += g & mask;
+        sum_b += b & mask;
+        count += mask & 1;
+    }
+
+    sums[0] += sum_r;
+    sums[1] += sum_g;
+    sums[2] += sum_b;
+    sums[3] += count;
+}
+
+void AsemanImageColorKernel::sumMoreSaturation(const QRgb *line, int width, quint32 *sums)
+{
+    quint32 sum_r = 0;
+    quint32 sum_g = 0;
+    quint32 sum_b = 0;
+    quint32 count = 0;
+    for( int i=0; i<width; i++ )
+    {
+        const quint32 px = line[i];
+        const quint32 r = (px >> 16) & 0xff;
+        const quint32 g = (px >> 8) & 0xff;
+        const quint32 b = px & 0xff;
+
+        const quint32 max = qMax(r, qMax(g, b));
+        const quint32 min = qMin(r, qMin(g, b));
+        const quint32 keep = quint32(131070*(max - min) >= 76799*max) & quint32(max + min >= 100);
+        const quint32 mask = 0u - keep;
+        sum_r += r & mask;
+        sum_g += g & mask;
+        sum_b += b & mask;
+        count += keep;
+    }
+
+    sums[0] += sum_r;
+    sums[1] += sum_g;
+    sums[2] += sum_b;
+    sums[3] += count;
+}
@@ -0,0 +1,45 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANIMAGECOLORKERNEL_H
+#define ASEMANIMAGECOLORKERNEL_H
+
+#include <QColor>
+#include <QImage>
+#include <QList>
+
+#include "asemantools_global.h"
+
+/*
+ * Color analysis kernels of AsemanImageColorAnalizor. The image is
+ * converted to ARGB32 once and walked row by row, with branchless
+ * integer filters the compiler can vectorize.
+ */
+class LIBASEMANTOOLSSHARED_EXPORT AsemanImageColorKernel
+{
+public:
+    static QColor average(const QImage &image, int method);
+    static QList<QColor> palette(const QImage &image, int count);
+
+private:
+    static QImage toArgb32(const QImage &image);
+    static void sumNormal(const QRgb *line, int width, quint32 *sums);
+    static void sumMoreSaturation(const QRgb *line, int width, quint32 *sums);
+};
+
+#endif // ASEMANIMAGECOLORKERNEL_H
@@ -0,0 +1,139 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asemanimagedecoder.h"
+#include "asemanimagecache.h"
+#include "asemanimagedecodestrategy.h"
+
+#include <QThread>
+#include <QPointer>
+
+static QPointer<QThreadPool> aseman_image_decoder_pool;
+
+class AsemanImageDecoderPrivate
+{
+public:
+    QString path;
+    QSize scaledSize;
+    bool autoTransform;
+    bool cache;
+};
+
+AsemanImageDecoder::AsemanImageDecoder(const QString &path, const QSize &scaledSize, bool autoTransform, bool cache) :
+    AsemanAbstractJob(pool())
+{
+    p = new AsemanImageDecoderPrivate;
+    p->path = path;
+    p->scaledSize = scaledSize;
+    p->autoTransform = autoTransform;
+    p->cache = cache;
+}
+
+QThreadPool *AsemanImageDecoder::pool()
+{
+    return sharedPool(aseman_image_decoder_pool, QThread::idealThreadCount());
+}
+
+QImage AsemanImageDecoder::decode(const QString &path, const QSize &scaledSize, bool autoTransform)
+{
+    return AsemanImageDecodeStrategy::decode(path, scaledSize, autoTransform);
+}
+
+/*
+ * Like decode(), but goes through the shared AsemanImageCache when
+ * cache is set. Decoders queued behind another one of the same image
+ * find it there when their turn comes.
+ */
+QImage AsemanImageDecoder::load(const QString &path, const QSize &scaledSize, bool autoTransform, bool cache)
+{
+    if(!cache)
+        return decode(path, scaledSize, autoTransform);
+
+    const QString &key = AsemanImageCache::key(path, scaledSize, autoTransform);
+    QImage image = AsemanImageCache::find(key);
+    if(!image.isNull())
+        return image;
+
+    image = decode(path, scaledSize, autoTransform);
+    AsemanImageCache::insert(key, image);
+    return image;
+}
+
+/*
+ * A quick look into the cache before starting a decoder. A miss is
+ * counted by the decoder itself.
+ */
+QImage AsemanImageDecoder::cached(const QString &path, const QSize &scaledSize, bool autoTransform)
+{
+    return AsemanImageCache::find( AsemanImageCache::key(path, scaledSize, autoTransform), false );
+}
+
+void AsemanImageDecoder::execute()
+{
+    if(!isCanceled())
+    {
+        Q_EMIT progress(0);
+
+        QImage image;
+        const QString &key = p->cache? AsemanImageCache::key(p->path, p->scaledSize, p->autoTransform) : QString();
+        if(p->cache)
+            image = AsemanImageCache::find(key);
+        if(image.isNull())
+        {
+            AsemanImageDecodeStrategy strategy(p->path, p->scaledSize, p->autoTransform);
+            previews(strategy);
+            if(!isCanceled())
+                image = strategy.decode();
+            if(p->cache && !image.isNull())
+                AsemanImageCache::insert(key, image);
+        }
+
+        Q_EMIT progress(1);
+        if(!isCanceled())
+            Q_EMIT finished(image);
+    }
+}
+
+/*
+ * Shows the cheap stages of the decode strategy before the final
+ * decode. They are not cached, the final image replaces them.
+ */
+void AsemanImageDecoder::previews(AsemanImageDecodeStrategy &strategy)
+{
+    const QImage &thumbnail = strategy.thumbnail();
+    if(!thumbnail.isNull() && !isCanceled())
+    {
+        Q_EMIT preview(thumbnail);
+        Q_EMIT progress(0.25);
+    }
+
+    if(isCanceled())
+        return;
+
+    const QImage &reduced = strategy.reduced();
+    if(!reduced.isNull() && !isCanceled())
+    {
+        Q_EMIT preview(reduced);
+        Q_EMIT progress(0.5);
+    }
+}
+
+AsemanImageDecoder::~AsemanImageDecoder()
+{
+    delete p;
+}
@@ -0,0 +1,65 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANIMAGEDECODER_H
+#define ASEMANIMAGEDECODER_H
+
+#include <QImage>
+#include <QSize>
+
+#include "asemantools_global.h"
+#include "asemanabstractjob.h"
+
+class QThreadPool;
+class AsemanImageDecodeStrategy;
+
+/*
+ * Decodes one image file on the image decoding pool. Before finished(),
+ * preview() may give smaller versions of the image from
+ * AsemanImageDecodeStrategy. A decoder canceled before it started
+ * does not read the file, and a canceled one never emits finished().
+ */
+class AsemanImageDecoderPrivate;
+class LIBASEMANTOOLSSHARED_EXPORT AsemanImageDecoder : public AsemanAbstractJob
+{
+    Q_OBJECT
+public:
+    AsemanImageDecoder(const QString &path, const QSize &scaledSize, bool autoTransform, bool cache = false);
+    virtual ~AsemanImageDecoder();
+
+    static QThreadPool *pool();
+    static QImage decode(const QString &path, const QSize &scaledSize, bool autoTransform);
+    static QImage load(const QString &path, const QSize &scaledSize, bool autoTransform, bool cache);
+    static QImage cached(const QString &path, const QSize &scaledSize, bool autoTransform);
+
+Q_SIGNALS:
+    void progress(qreal progress);
+    void preview(const QImage &image);
+    void finished(const QImage &image);
+
+protected:
+    virtual void execute();
+
+private:
+    void previews(AsemanImageDecodeStrategy &strategy);
+
+private:
+    AsemanImageDecoderPrivate *p;
+};
+
+#endif // ASEMANIMAGEDECODER_H
@@ -0,0 +1,271 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define EXIF_SEARCH_SIZE 131072
+#define PREVIEW_MIN_PIXELS 1048576
+#define PREVIEW_DENOMINATOR 8
+
+#include "asemanimagedecodestrategy.h"
+
+#include <QImageReader>
+#include <QTransform>
+#include <QFile>
+#include <QtEndian>
+
+AsemanImageDecodeStrategy::AsemanImageDecodeStrategy(const QString &path, const QSize &scaledSize, bool autoTransform) :
+    _path(path),
+    _scaledSize(scaledSize),
+    _autoTransform(autoTransform),
+    _header(AsemanImageHeader::read(path)),
+    _thumbnailLoaded(false)
+{
+    if(!_scaledSize.isValid() || _scaledSize.isEmpty())
+        _scaledSize = QSize();
+
+    // The stages work in the file orientation
+    if(_autoTransform && (_header.transformation() & QImageIOHandler::TransformationRotate90))
+        _scaledSize.transpose();
+}
+
+/*
+ * The embedded thumbnail, when it is only good for a preview. When it
+ * is big enough decode() returns it itself, so there is nothing to show
+ * before.
+ */
+QImage AsemanImageDecodeStrategy::thumbnail()
+{
+    if(exifThumbnail().isNull() || thumbnailCovers())
+        return QImage();
+
+    return transformed(_thumbnail);
+}
+
+/*
+ * A 1/8 decode of a large JPEG that is going to be decoded at full
+ * resolution. Smaller images decode fast enough without it.
+ */
+QImage AsemanImageDecodeStrategy::reduced()
+{
+    if(!isJpeg() || denominator() != 1 || thumbnailCovers())
+        return QImage();
+
+    const QSize &size = _header.size();
+    if(qint64(size.width())*size.height() < PREVIEW_MIN_PIXELS)
+        return QImage();
+
+    QImageReader reader(_path);
+    reader.setScaledSize( QSize((size.width()+PREVIEW_DENOMINATOR-1)/PREVIEW_DENOMINATOR,
+                                (size.height()+PREVIEW_DENOMINATOR-1)/PREVIEW_DENOMINATOR) );
+    return transformed(reader.read());
+}
+
+QImage AsemanImageDecodeStrategy::decode()
+{
+    if(thumbnailCovers())
+    {
+        const QImage &image = (_thumbnail.size() == _scaledSize)? _thumbnail :
+                              _thumbnail.scaled(_scaledSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        return transformed(image);
+    }
+
+    QImageReader reader(_path);
+    const int denom = denominator();
+    if(denom > 1)
+    {
+        // The size libjpeg gives at this scale, resized smoothly below
+        const QSize &size = _header.size();
+        const QSize dctSize((size.width()+denom-1)/denom, (size.height()+denom-1)/denom);
+        reader.setScaledSize(dctSize);
+
+        QImage image = reader.read();
+        if(!image.isNull() && image.size() != _scaledSize)
+            image = image.scaled(_scaledSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+        return transformed(image);
+    }
+
+    if(_scaledSize.isValid())
+        reader.setScaledSize(_scaledSize);
+
+    return transformed(reader.read());
+}
+
+/*
+ * The biggest of 8, 4 and 2 that keeps the JPEG at least as big as the
+ * scaled size, or 1 when the full resolution is needed. It is the same
+ * scale Qt's JPEG handler picks for that size.
+ */
+int AsemanImageDecodeStrategy::denominator() const
+{
+    if(!isJpeg() || !_scaledSize.isValid())
+        return 1;
+
+    const QSize &size = _header.size();
+    for(int denom=8; denom>1; denom/=2)
+        if((size.width()+denom-1)/denom >= _scaledSize.width() &&
+           (size.height()+denom-1)/denom >= _scaledSize.height())
+            return denom;
+
+    return 1;
+}
+
+QImage AsemanImageDecodeStrategy::decode(const QString &path, const QSize &scaledSize, bool autoTransform)
+{
+    return AsemanImageDecodeStrategy(path, scaledSize, autoTransform).decode();
+}
+
+bool AsemanImageDecodeStrategy::isJpeg() const
+{
+    return _header.isValid() && _header.format() == "jpeg" && !_header.size().isEmpty();
+}
+
+bool AsemanImageDecodeStrategy::thumbnailCovers()
+{
+    if(!_scaledSize.isValid() || exifThumbnail().isNull())
+        return false;
+
+    return _thumbnail.width() >= _scaledSize.width() && _thumbnail.height() >= _scaledSize.height();
+}
+
+/*
+ * Finds the JPEG thumbnail in the IFD1 of the EXIF APP1 segment. Only
+ * the first EXIF_SEARCH_SIZE bytes of the file are read, APP1 segments
+ * are at most 64 KB and come before the image data.
+ */
+const QImage &AsemanImageDecodeStrategy::exifThumbnail()
+{
+    if(_thumbnailLoaded)
+        return _thumbnail;
+
+    _thumbnailLoaded = true;
+    if(!isJpeg())
+        return _thumbnail;
+
+    QFile file(_path);
+    if(!file.open(QFile::ReadOnly))
+        return _thumbnail;
+
+    const QByteArray head = file.read(EXIF_SEARCH_SIZE);
+    const uchar *data = reinterpret_cast<const uchar*>(head.constData());
+    const qint64 size = head.size();
+    if(size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return _thumbnail;
+
+    const uchar *tiff = 0;
+    qint64 tiffSize = 0;
+    qint64 pos = 2;
+    while(pos + 4 <= size && data[pos] == 0xFF)
+    {
+        const uchar marker = data[pos+1];
+        if(marker == 0xFF)
+        {
+            pos++;
+            continue;
+        }
+        if(marker == 0xDA || marker == 0xD9)
+            break;
+
+        const qint64 length = qFromBigEndian<quint16>(data + pos + 2);
+        const qint64 end = pos + 2 + length;
+        if(length < 2 || end > size)
+            break;
+        if(marker == 0xE1 && length >= 16 && QByteArray::fromRawData(reinterpret_cast<const char*>(data + pos + 4), 6) == QByteArray("Exif\0\0", 6))
+        {
+            tiff = data + pos + 10;
+            tiffSize = length - 8;
+            break;
+        }
+
+        pos = end;
+    }
+
+    if(!tiff)
+        return _thumbnail;
+
+    const bool little = (tiff[0] == 'I' && tiff[1] == 'I');
+    if(!little && !(tiff[0] == 'M' && tiff[1] == 'M'))
+        return _thumbnail;
+
+    auto read16 = [tiff, little](qint64 offset) -> qint64 {
+        return little? qFromLittleEndian<quint16>(tiff + offset) : qFromBigEndian<quint16>(tiff + offset);
+    };
+    auto read32 = [tiff, little](qint64 offset) -> qint64 {
+        return little? qFromLittleEndian<quint32>(tiff + offset) : qFromBigEndian<quint32>(tiff + offset);
+    };
+
+    // IFD0 only links to IFD1, which describes the thumbnail
+    const qint64 ifd0 = read32(4);
+    if(ifd0 < 8 || ifd0 + 2 > tiffSize)
+        return _thumbnail;
+
+    const qint64 link = ifd0 + 2 + 12*read16(ifd0);
+    if(link + 4 > tiffSize)
+        return _thumbnail;
+
+    const qint64 ifd1 = read32(link);
+    if(ifd1 < 8 || ifd1 + 2 > tiffSize)
+        return _thumbnail;
+
+    qint64 offset = 0;
+    qint64 length = 0;
+    const qint64 count = read16(ifd1);
+    for(qint64 i=0; i<count && ifd1 + 2 + 12*i + 12 <= tiffSize; i++)
+    {
+        const qint64 entry = ifd1 + 2 + 12*i;
+        const qint64 tag = read16(entry);
+        if(tag == 0x0201)
+            offset = read32(entry + 8);
+        else
+        if(tag == 0x0202)
+            length = read32(entry + 8);
+    }
+
+    if(offset <= 0 || length <= 0 || offset + length > tiffSize)
+        return _thumbnail;
+
+    const QImage &thumbnail = QImage::fromData(tiff + offset, int(length), "JPEG");
+    if(thumbnail.isNull())
+        return _thumbnail;
+
+    // Some cameras letterbox the thumbnail, it is useless then
+    const QSize &imageSize = _header.size();
+    const qint64 diff = qAbs( qint64(thumbnail.width())*imageSize.height() - qint64(thumbnail.height())*imageSize.width() );
+    if(diff*100 > qint64(thumbnail.height())*imageSize.width())
+        return _thumbnail;
+
+    _thumbnail = thumbnail;
+    return _thumbnail;
+}
+
+/*
+ * Every stage is decoded in the file orientation and rotated at the
+ * end, the same way QImageReader::setAutoTransform does it.
+ */
+QImage AsemanImageDecodeStrategy::transformed(const QImage &image) const
+{
+    const QImageIOHandler::Transformations transformation = _header.transformation();
+    if(!_autoTransform || image.isNull() || transformation == QImageIOHandler::TransformationNone)
+        return image;
+
+    QImage result = image.mirrored(transformation & QImageIOHandler::TransformationMirror,
+                                   transformation & QImageIOHandler::TransformationFlip);
+    if(transformation & QImageIOHandler::TransformationRotate90)
+        result = result.transformed(QTransform().rotate(90));
+
+    return result;
+}
@@ -0,0 +1,74 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANIMAGEDECODESTRATEGY_H
+#define ASEMANIMAGEDECODESTRATEGY_H
+
+#include <QImage>
+#include <QString>
+#include <QSize>
+
+#include "asemanimageheader.h"
+#include "asemantools_global.h"
+
+/*
+ * Picks the cheapest way to get an image file at a given size:
+ *  - The thumbnail embedded in the EXIF data of a JPEG, when it has the
+ *    aspect ratio of the image and is at least as big as the size.
+ *  - A JPEG read at the 1/2, 1/4 or 1/8 size libjpeg gives, then
+ *    smoothly scaled to the size. Qt's JPEG handler already uses the
+ *    same libjpeg scale for any scaled size, so this reads no fewer
+ *    pixels than setScaledSize(), only the last resize is done here.
+ *  - A read at the size, when it needs more than half of the image
+ *    resolution.
+ * With autoTransform the scaled size is the size after the EXIF
+ * orientation is applied.
+ * thumbnail() and reduced() give the cheaper stages as previews while
+ * decode() is not done yet. They are null when there is nothing to
+ * preview. An instance is for one thread, the static decode() is
+ * thread safe.
+ */
+class LIBASEMANTOOLSSHARED_EXPORT AsemanImageDecodeStrategy
+{
+public:
+    AsemanImageDecodeStrategy(const QString &path, const QSize &scaledSize, bool autoTransform);
+
+    QImage thumbnail();
+    QImage reduced();
+    QImage decode();
+
+    int denominator() const;
+
+    static QImage decode(const QString &path, const QSize &scaledSize, bool autoTransform);
+
+private:
+    bool isJpeg() const;
+    bool thumbnailCovers();
+    const QImage &exifThumbnail();
+    QImage transformed(const QImage &image) const;
+
+private:
+    QString _path;
+    QSize _scaledSize;
+    bool _autoTransform;
+    AsemanImageHeader _header;
+    QImage _thumbnail;
+    bool _thumbnailLoaded;
+};
+
+#endif // ASEMANIMAGEDECODESTRATEGY_H
@@ -0,0 +1,142 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define DEFAULT_CACHE_SIZE 4096
+
+#include "asemanimageheader.h"
+
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QImageReader>
+
+class AsemanImageHeaderCacheEntry
+{
+public:
+    qint64 size;
+    qint64 modified;
+    AsemanImageHeader header;
+};
+
+class AsemanImageHeaderCache
+{
+public:
+    AsemanImageHeaderCache() : cache(DEFAULT_CACHE_SIZE) {}
+
+    QMutex mutex;
+    QCache<QString, AsemanImageHeaderCacheEntry> cache;
+};
+
+static AsemanImageHeaderCache *aseman_image_header_cache()
+{
+    static AsemanImageHeaderCache *cache = new AsemanImageHeaderCache;
+    return cache;
+}
+
+AsemanImageHeader::AsemanImageHeader() :
+    _transformation(QImageIOHandler::TransformationNone)
+{
+}
+
+bool AsemanImageHeader::isValid() const
+{
+    return _size.isValid();
+}
+
+QSize AsemanImageHeader::size() const
+{
+    return _size;
+}
+
+/*
+ * The size the image has after its EXIF orientation is applied.
+ */
+QSize AsemanImageHeader::transformedSize() const
+{
+    if(_transformation & QImageIOHandler::TransformationRotate90)
+        return _size.transposed();
+
+    return _size;
+}
+
+QByteArray AsemanImageHeader::format() const
+{
+    return _format;
+}
+
+QImageIOHandler::Transformations AsemanImageHeader::transformation() const
+{
+    return _transformation;
+}
+
+AsemanImageHeader AsemanImageHeader::read(const QString &path)
+{
+    const QFileInfo info(path);
+    if(!info.exists())
+        return AsemanImageHeader();
+
+    const qint64 size = info.size();
+    const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+
+    AsemanImageHeaderCache *cache = aseman_image_header_cache();
+    {
+        QMutexLocker locker(&cache->mutex);
+        AsemanImageHeaderCacheEntry *entry = cache->cache.object(path);
+        if(entry && entry->size == size && entry->modified == modified)
+            return entry->header;
+    }
+
+    // Only the header is parsed, the image itself is not decoded
+    QImageReader reader(path);
+    AsemanImageHeader header;
+    header._size = reader.size();
+    header._format = reader.format();
+    header._transformation = reader.transformation();
+
+    AsemanImageHeaderCacheEntry *entry = new AsemanImageHeaderCacheEntry;
+    entry->size = size;
+    entry->modified = modified;
+    entry->header = header;
+
+    QMutexLocker locker(&cache->mutex);
+    cache->cache.insert(path, entry);
+    return header;
+}
+
+void AsemanImageHeader::setCacheSize(int size)
+{
+    AsemanImageHeaderCache *cache = aseman_image_header_cache();
+    QMutexLocker locker(&cache->mutex);
+    cache->cache.setMaxCost(size);
+}
+
+int AsemanImageHeader::cacheSize()
+{
+    AsemanImageHeaderCache *cache = aseman_image_header_cache();
+    QMutexLocker locker(&cache->mutex);
+    return cache->cache.maxCost();
+}
+
+void AsemanImageHeader::clearCache()
+{
+    AsemanImageHeaderCache *cache = aseman_image_header_cache();
+    QMutexLocker locker(&cache->mutex);
+    cache->cache.clear();
+}
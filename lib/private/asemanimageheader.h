@@ -0,0 +1,59 @@
+/*
+    Copyright (C) 2017 Aseman Team
+    http://aseman.co
+
+    AsemanQtTools is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AsemanQtTools is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASEMANIMAGEHEADER_H
+#define ASEMANIMAGEHEADER_H
+
+#include <QSize>
+#include <QString>
+#include <QByteArray>
+#include <QImageIOHandler>
+
+#include "asemantools_global.h"
+
+/*
+ * Dimensions, format and EXIF orientation of an image file.
+ * read() keeps them in a process wide cache keyed by the path, which
+ * is only trusted while the file size and modification time are the
+ * same, so asking again only costs a stat(). It is thread safe.
+ */
+class LIBASEMANTOOLSSHARED_EXPORT AsemanImageHeader
+{
+public:
+    AsemanImageHeader();
+
+    bool isValid() const;
+
+    QSize size() const;
+    QSize transformedSize() const;
+    QByteArray format() const;
+    QImageIOHandler::Transformations transformation() const;
+
+    static AsemanImageHeader read(const QString &path);
+
+    static void setCacheSize(int size);
+    static int cacheSize();
+    static void clearCache();
+
+private:
+    QSize _size;
+    QByteArray _format;
+    QImageIOHandler::Transformations _transformation;
+};
+
+#endif // ASEMANIMAGEHEADER_H